@@ -0,0 +1,356 @@
+#include "provided.h"
+#include "StreetGraph.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+#include <random>
+using namespace std;
+
+// Times the hot paths one at a time and prints one JSON object per line:
+//
+//   {"bench":"route_astar","map":"mapdata.txt","ops":1000,"ops_per_sec":...,
+//    "p50_us":...,"p99_us":...,"allocs_per_op":...}
+//
+// Every random choice comes from --seed, so two runs over the same map time the
+// same work.  Allocations are counted by replacing the global operator new.
+//
+// usage: Benchmark [--seed S] [--pairs N] [--reps N] [map files...]   (default mapdata.txt)
+
+//******************** allocation counting ************************************
+
+namespace
+{
+    atomic<uint64_t> allocations(0);
+
+    void* allocate(size_t size)
+    {
+        allocations.fetch_add(1, memory_order_relaxed);
+        return malloc(size == 0 ? 1 : size);
+    }
+
+#ifdef __cpp_aligned_new
+    void* allocateAligned(size_t size, align_val_t alignment)
+    {
+        //aligned_alloc wants a whole number of alignments
+        size_t align = static_cast<size_t>(alignment);
+        allocations.fetch_add(1, memory_order_relaxed);
+        return aligned_alloc(align, (max<size_t>(size, 1) + align - 1) / align * align);
+    }
+#endif
+}
+
+// Every form of operator new and operator delete is replaced, so memory from new
+// going to free is correct here; GCC can't tell and warns once the operators are
+// inlined, so the warning is off for these definitions only.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(size_t size)
+{
+    if (void* p = allocate(size))
+        return p;
+    throw bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(size_t size, const nothrow_t&) noexcept
+{
+    return allocate(size);
+}
+
+void* operator new[](size_t size, const nothrow_t&) noexcept
+{
+    return allocate(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, const nothrow_t&) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, const nothrow_t&) noexcept
+{
+    free(p);
+}
+
+#ifdef __cpp_aligned_new
+void* operator new(size_t size, align_val_t alignment)
+{
+    if (void* p = allocateAligned(size, alignment))
+        return p;
+    throw bad_alloc();
+}
+
+void* operator new[](size_t size, align_val_t alignment)
+{
+    return operator new(size, alignment);
+}
+
+void* operator new(size_t size, align_val_t alignment, const nothrow_t&) noexcept
+{
+    return allocateAligned(size, alignment);
+}
+
+void* operator new[](size_t size, align_val_t alignment, const nothrow_t&) noexcept
+{
+    return allocateAligned(size, alignment);
+}
+
+void operator delete(void* p, align_val_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, align_val_t) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t, align_val_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, size_t, align_val_t) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, align_val_t, const nothrow_t&) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, align_val_t, const nothrow_t&) noexcept
+{
+    free(p);
+}
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+//******************** measuring and reporting ********************************
+
+namespace
+{
+    typedef chrono::steady_clock Clock;
+
+    struct Options
+    {
+        uint64_t seed = 20200308;
+        int pairs = 1000;
+        int reps = 5;
+        vector<string> maps;
+    };
+
+    // the time and allocations of every operation of one benchmark
+    class Measurement
+    {
+    public:
+        template <typename Op>
+        void run(Op op)
+        {
+            uint64_t allocated = allocations.load(memory_order_relaxed);
+            Clock::time_point start = Clock::now();
+            op();
+            Clock::time_point stop = Clock::now();
+            m_allocations += allocations.load(memory_order_relaxed) - allocated;
+            m_micros.push_back(chrono::duration<double, micro>(stop - start).count());
+        }
+
+        void report(const string& bench, const string& map) const;
+
+    private:
+        vector<double> m_micros;
+        uint64_t m_allocations = 0;
+    };
+
+    void Measurement::report(const string& bench, const string& map) const
+    {
+        if (m_micros.empty())
+            return;
+        vector<double> sorted(m_micros);
+        sort(sorted.begin(), sorted.end());
+        double total = 0;
+        for (double us : sorted)
+            total += us;
+        //nearest rank percentiles
+        auto percentile = [&](double p) {
+            size_t rank = static_cast<size_t>(p / 100 * sorted.size() + 0.999999);
+            return sorted[min(sorted.size() - 1, rank == 0 ? 0 : rank - 1)];
+        };
+        printf("{\"bench\":\"%s\",\"map\":\"%s\",\"ops\":%zu,\"ops_per_sec\":%.1f,"
+               "\"p50_us\":%.2f,\"p99_us\":%.2f,\"allocs_per_op\":%.2f}\n",
+               bench.c_str(), map.c_str(), sorted.size(), total > 0 ? sorted.size() / (total * 1e-6) : 0.0,
+               percentile(50), percentile(99), double(m_allocations) / sorted.size());
+        fflush(stdout);
+    }
+
+    vector<DeliveryRequest> randomDeliveries(const StreetGraph& graph, const vector<uint32_t>& nodes, int count, mt19937_64& random)
+    {
+        vector<DeliveryRequest> deliveries;
+        for (int i = 0; i < count; i++)
+            deliveries.push_back(DeliveryRequest("item " + to_string(i), graph.coord(nodes[random() % nodes.size()])));
+        return deliveries;
+    }
+
+    void benchmarkMap(const string& map, const Options& options)
+    {
+        StreetMap sm;
+        {
+            Measurement load;
+            for (int rep = 0; rep < options.reps; rep++)
+            {
+                StreetMap fresh;
+                load.run([&] { fresh.load(map); });
+            }
+            load.report("load", map);
+        }
+        if (!sm.load(map) || sm.graph().nodeCount() == 0)
+        {
+            cerr << "Unable to load map data file " << map << endl;
+            return;
+        }
+        const StreetGraph& graph = sm.graph();
+        //deliveries and route ends come from the largest connected part, where every route exists
+        vector<uint32_t> nodes = graph.largestComponent();
+        mt19937_64 random(options.seed);
+
+        //node lookups, from coordinates made up front
+        {
+            vector<GeoCoord> coords;
+            for (int i = 0; i < options.pairs; i++)
+                coords.push_back(graph.coord(random() % graph.nodeCount()));
+            Measurement segments;
+            vector<StreetSegment> segs;
+            for (const GeoCoord& gc : coords)
+                segments.run([&] { sm.getSegmentsThatStartWith(gc, segs); });
+            segments.report("segments", map);
+        }
+
+        //the same pairs for every search mode
+        vector<pair<GeoCoord, GeoCoord>> pairs;
+        for (int i = 0; i < options.pairs; i++)
+            pairs.push_back(make_pair(graph.coord(nodes[random() % nodes.size()]), graph.coord(nodes[random() % nodes.size()])));
+        auto routes = [&](const char* bench, RouteSearchMode mode) {
+            PointToPointRouter router(&sm);
+            router.setSearchMode(mode);
+            Measurement measurement;
+            list<StreetSegment> route;
+            double miles;
+            for (const auto& p : pairs)
+                measurement.run([&] { router.generatePointToPointRoute(p.first, p.second, route, miles); });
+            measurement.report(bench, map);
+        };
+        routes("route_astar", SEARCH_ASTAR);
+        routes("route_bidirectional", SEARCH_BIDIRECTIONAL_ASTAR);
+        {
+            Measurement build;
+            build.run([&] { sm.buildHierarchy(); });
+            build.report("build_hierarchy", map);
+        }
+        routes("route_hierarchy", SEARCH_CONTRACTION_HIERARCHY);
+        {
+            Measurement build;
+            build.run([&] { sm.buildLandmarks(); });
+            build.report("build_landmarks", map);
+        }
+        routes("route_astar_landmarks", SEARCH_ASTAR);
+
+        //ordering deliveries, and whole plans
+        const int SIZES[] = { 5, 10, 25, 50, 100 };
+        for (int size : SIZES)
+        {
+            DeliveryOptimizer optimizer(&sm);
+            Measurement measurement;
+            for (int rep = 0; rep < options.reps; rep++)
+            {
+                GeoCoord depot = graph.coord(nodes[random() % nodes.size()]);
+                vector<DeliveryRequest> deliveries = randomDeliveries(graph, nodes, size, random);
+                double oldCrow, newCrow;
+                measurement.run([&] { optimizer.optimizeDeliveryOrder(depot, deliveries, oldCrow, newCrow); });
+            }
+            measurement.report("optimize_" + to_string(size), map);
+        }
+        for (int size : { 10, 25 })
+        {
+            DeliveryPlanner planner(&sm);
+            Measurement measurement;
+            for (int rep = 0; rep < options.reps; rep++)
+            {
+                GeoCoord depot = graph.coord(nodes[random() % nodes.size()]);
+                vector<DeliveryRequest> deliveries = randomDeliveries(graph, nodes, size, random);
+                vector<DeliveryCommand> commands;
+                double miles;
+                measurement.run([&] { planner.generateDeliveryPlan(depot, deliveries, commands, miles); });
+            }
+            measurement.report("plan_" + to_string(size), map);
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if ((arg == "--seed" || arg == "--pairs" || arg == "--reps") && i + 1 < argc)
+        {
+            long long value = atoll(argv[++i]);
+            if (arg == "--seed")
+                options.seed = static_cast<uint64_t>(value);
+            else if (arg == "--pairs")
+                options.pairs = max(1, static_cast<int>(value));
+            else
+                options.reps = max(1, static_cast<int>(value));
+        }
+        else if (arg.compare(0, 2, "--") == 0)
+        {
+            cerr << "Usage: " << argv[0] << " [--seed S] [--pairs N] [--reps N] [map files...]" << endl;
+            return 1;
+        }
+        else
+            options.maps.push_back(arg);
+    }
+    if (options.maps.empty())
+        options.maps.push_back("mapdata.txt");
+
+    for (const string& map : options.maps)
+        benchmarkMap(map, options);
+}
@@ -0,0 +1,484 @@
+#include "ContractionHierarchy.h"
+
+#include <cstring>
+#include <cmath>
+#include <fstream>
+#include <queue>
+#include <functional>
+#include <utility>
+using namespace std;
+
+// Image layout (native byte order, every section starts on an 8 byte boundary):
+//
+//   HierarchyHeader
+//   uint32_t  ranks[nodeCount]
+//   Arc       arcs[arcCount]            street edges and shortcuts
+//   uint32_t  upOffsets[nodeCount + 1]  CSR offsets into upArcs
+//   UpArc     upArcs[upArcCount]
+//
+// graphChecksum is the StreetGraph image checksum the hierarchy was built from,
+// so a file is never used with a different map.  Bump HIERARCHY_VERSION whenever
+// the layout, the meaning of any field or the graph image format changes.
+
+namespace
+{
+    const char     HIERARCHY_MAGIC[8] = { 'M', 'O', 'V', 'E', 'I', 'T', 'C', 'H' };
+    const uint32_t HIERARCHY_VERSION = 1;
+    const uint32_t HIERARCHY_BYTE_ORDER = 0x01020304;
+
+    struct HierarchyHeader
+    {
+        char     magic[8];
+        uint32_t version;
+        uint32_t byteOrder;
+        uint64_t imageSize;
+        uint64_t checksum;
+        uint64_t graphChecksum;
+        uint32_t nodeCount;
+        uint32_t arcCount;
+        uint32_t upArcCount;
+        uint32_t unused;
+        uint64_t ranksAt;
+        uint64_t arcsAt;
+        uint64_t upOffsetsAt;
+        uint64_t upArcsAt;
+    };
+
+    typedef ContractionHierarchy::Arc Arc;
+    typedef ContractionHierarchy::UpArc UpArc;
+
+    // a witness search gives up after settling this many nodes and just adds the
+    // shortcut; that only costs an unneeded arc, never a wrong route
+    const int WITNESS_SETTLE_LIMIT = 500;
+
+    // Does the actual contraction.  The graph still being contracted is kept as a
+    // list of links per node, each link naming the arc that joins the two nodes.
+    class Contractor
+    {
+    public:
+        Contractor(const StreetGraph& graph);
+        void run(vector<uint32_t>& ranks, vector<Arc>& arcs, vector<vector<UpArc>>& up);
+    private:
+        struct Link
+        {
+            uint32_t node;
+            uint32_t arc;
+            double   length;
+        };
+
+        vector<vector<Link>> m_links;
+        vector<Arc> m_arcs;
+        vector<bool> m_contracted;
+        vector<int> m_contractedNeighbors;
+
+        //witness search state, reset through m_touched after every search
+        vector<double> m_distance;
+        vector<uint32_t> m_touched;
+
+        void addArc(uint32_t u, uint32_t w, double length, uint32_t middle, uint32_t first, uint32_t second);
+        void witnessSearch(uint32_t source, uint32_t skip, double maxDistance);
+        int contract(uint32_t node, bool addShortcuts);
+        int priority(uint32_t node);
+    };
+
+    Contractor::Contractor(const StreetGraph& graph)
+        :m_links(graph.nodeCount()), m_contracted(graph.nodeCount(), false),
+        m_contractedNeighbors(graph.nodeCount(), 0), m_distance(graph.nodeCount(), INFINITY)
+    {
+        //one arc per pair of joined nodes, the shortest street edge between them
+        for (uint32_t node = 0; node < graph.nodeCount(); node++)
+            for (const StreetEdge* e = graph.edgesBegin(node); e != graph.edgesEnd(node); e++)
+                if (e->to != node)
+                    addArc(node, e->to, e->length, StreetGraph::NO_NODE, graph.edgeIndex(e), ContractionHierarchy::NO_ARC);
+    }
+
+    //join u and w with a new arc, unless they are already joined at least as closely
+    void Contractor::addArc(uint32_t u, uint32_t w, double length, uint32_t middle, uint32_t first, uint32_t second)
+    {
+        for (Link& link : m_links[u])
+        {
+            if (link.node != w)
+                continue;
+            if (link.length <= length)
+                return;
+            //the new arc is shorter, so it takes over the link both ways
+            uint32_t arc = static_cast<uint32_t>(m_arcs.size());
+            m_arcs.push_back(Arc{ u, w, length, middle, first, second });
+            link.arc = arc;
+            link.length = length;
+            for (Link& back : m_links[w])
+            {
+                if (back.node == u)
+                {
+                    back.arc = arc;
+                    back.length = length;
+                }
+            }
+            return;
+        }
+        uint32_t arc = static_cast<uint32_t>(m_arcs.size());
+        m_arcs.push_back(Arc{ u, w, length, middle, first, second });
+        m_links[u].push_back(Link{ w, arc, length });
+        m_links[w].push_back(Link{ u, arc, length });
+    }
+
+    //distances from source in the remaining graph without skip, up to maxDistance
+    void Contractor::witnessSearch(uint32_t source, uint32_t skip, double maxDistance)
+    {
+        for (uint32_t node : m_touched)
+            m_distance[node] = INFINITY;
+        m_touched.clear();
+
+        typedef pair<double, uint32_t> Entry;
+        priority_queue<Entry, vector<Entry>, greater<Entry>> open;
+        m_distance[source] = 0;
+        m_touched.push_back(source);
+        open.push(Entry(0, source));
+        int settled = 0;
+        while (!open.empty() && settled < WITNESS_SETTLE_LIMIT)
+        {
+            Entry top = open.top();
+            open.pop();
+            if (top.first > m_distance[top.second])
+                continue;
+            if (top.first > maxDistance)
+                break;
+            settled++;
+            for (const Link& link : m_links[top.second])
+            {
+                if (link.node == skip || m_contracted[link.node])
+                    continue;
+                double goal = top.first + link.length;
+                if (goal < m_distance[link.node])
+                {
+                    if (m_distance[link.node] == INFINITY)
+                        m_touched.push_back(link.node);
+                    m_distance[link.node] = goal;
+                    open.push(Entry(goal, link.node));
+                }
+            }
+        }
+    }
+
+    //count (and if asked, add) the shortcuts contracting node needs
+    int Contractor::contract(uint32_t node, bool addShortcuts)
+    {
+        //copied, since adding shortcuts can touch this node's neighbors' lists
+        vector<Link> links = m_links[node];
+        int shortcuts = 0;
+        for (size_t i = 0; i + 1 < links.size(); i++)
+        {
+            double longest = 0;
+            for (size_t j = i + 1; j < links.size(); j++)
+                longest = max(longest, links[j].length);
+            witnessSearch(links[i].node, node, links[i].length + longest);
+
+            for (size_t j = i + 1; j < links.size(); j++)
+            {
+                double through = links[i].length + links[j].length;
+                //another path at least as short means the shortcut isn't needed
+                if (m_distance[links[j].node] <= through)
+                    continue;
+                shortcuts++;
+                if (addShortcuts)
+                    addArc(links[i].node, links[j].node, through, node, links[i].arc, links[j].arc);
+            }
+        }
+        return shortcuts;
+    }
+
+    //edge difference, plus how many neighbors are gone already to spread contraction out
+    int Contractor::priority(uint32_t node)
+    {
+        return contract(node, false) - static_cast<int>(m_links[node].size()) + m_contractedNeighbors[node];
+    }
+
+    void Contractor::run(vector<uint32_t>& ranks, vector<Arc>& arcs, vector<vector<UpArc>>& up)
+    {
+        uint32_t nodeCount = static_cast<uint32_t>(m_links.size());
+        ranks.assign(nodeCount, 0);
+        up.assign(nodeCount, vector<UpArc>());
+
+        //least important first; ties go to the lower node id, so builds are repeatable
+        typedef pair<int, uint32_t> Entry;
+        priority_queue<Entry, vector<Entry>, greater<Entry>> order;
+        vector<int> current(nodeCount);
+        for (uint32_t node = 0; node < nodeCount; node++)
+        {
+            current[node] = priority(node);
+            order.push(Entry(current[node], node));
+        }
+
+        uint32_t nextRank = 0;
+        while (!order.empty())
+        {
+            Entry top = order.top();
+            order.pop();
+            if (m_contracted[top.second] || top.first != current[top.second])
+                continue;
+
+            //priorities go stale as neighbors are contracted; recheck before committing
+            uint32_t node = top.second;
+            int fresh = priority(node);
+            if (fresh > top.first && !order.empty() && fresh > order.top().first)
+            {
+                current[node] = fresh;
+                order.push(Entry(fresh, node));
+                continue;
+            }
+
+            //the remaining neighbors are all contracted later, so they are the up arcs
+            ranks[node] = nextRank++;
+            for (const Link& link : m_links[node])
+                up[node].push_back(UpArc{ link.node, link.arc, link.length });
+            contract(node, true);
+            m_contracted[node] = true;
+
+            for (const Link& link : m_links[node])
+            {
+                vector<Link>& back = m_links[link.node];
+                for (size_t i = 0; i < back.size(); i++)
+                {
+                    if (back[i].node == node)
+                    {
+                        back[i] = back.back();
+                        back.pop_back();
+                        break;
+                    }
+                }
+                m_contractedNeighbors[link.node]++;
+            }
+            vector<Link>().swap(m_links[node]);
+
+            for (const UpArc& neighbor : up[node])
+            {
+                current[neighbor.to] = priority(neighbor.to);
+                order.push(Entry(current[neighbor.to], neighbor.to));
+            }
+        }
+        arcs.swap(m_arcs);
+    }
+}
+
+ContractionHierarchy::ContractionHierarchy()
+{
+    clear();
+}
+
+ContractionHierarchy::~ContractionHierarchy()
+{
+}
+
+void ContractionHierarchy::clear()
+{
+    m_file.close();
+    vector<uint64_t>().swap(m_buffer);
+    m_image = nullptr;
+    m_imageSize = 0;
+    m_graphChecksum = 0;
+    m_nodeCount = 0;
+    m_arcCount = 0;
+    m_ranks = nullptr;
+    m_arcs = nullptr;
+    m_upOffsets = nullptr;
+    m_upArcs = nullptr;
+}
+
+void ContractionHierarchy::unpack(uint32_t arc, uint32_t from, vector<RouteStep>& path) const
+{
+    //shortcuts can nest deeply, so walk them with a stack of (arc, starting end)
+    vector<pair<uint32_t, uint32_t>> pending;
+    pending.push_back(make_pair(arc, from));
+    while (!pending.empty())
+    {
+        const Arc& a = m_arcs[pending.back().first];
+        uint32_t start = pending.back().second;
+        pending.pop_back();
+        uint32_t finish = start == a.a ? a.b : a.a;
+        if (a.middle == StreetGraph::NO_NODE)
+        {
+            path.push_back(RouteStep{ start, finish, a.first });
+            continue;
+        }
+        //push the second half first so the first half comes off the stack first
+        if (start == a.a)
+        {
+            pending.push_back(make_pair(a.second, a.middle));
+            pending.push_back(make_pair(a.first, start));
+        }
+        else
+        {
+            pending.push_back(make_pair(a.first, a.middle));
+            pending.push_back(make_pair(a.second, start));
+        }
+    }
+}
+
+void ContractionHierarchy::build(const StreetGraph& graph)
+{
+    vector<uint32_t> ranks;
+    vector<Arc> arcs;
+    vector<vector<UpArc>> up;
+    Contractor(graph).run(ranks, arcs, up);
+
+    uint32_t nodeCount = graph.nodeCount();
+    uint64_t upArcCount = 0;
+    for (const auto& list : up)
+        upArcCount += list.size();
+
+    HierarchyHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, HIERARCHY_MAGIC, sizeof(HIERARCHY_MAGIC));
+    header.version = HIERARCHY_VERSION;
+    header.byteOrder = HIERARCHY_BYTE_ORDER;
+    header.graphChecksum = graph.checksum();
+    header.nodeCount = nodeCount;
+    header.arcCount = static_cast<uint32_t>(arcs.size());
+    header.upArcCount = static_cast<uint32_t>(upArcCount);
+    header.ranksAt = align8(sizeof(HierarchyHeader));
+    header.arcsAt = align8(header.ranksAt + uint64_t(nodeCount) * sizeof(uint32_t));
+    header.upOffsetsAt = align8(header.arcsAt + arcs.size() * sizeof(Arc));
+    header.upArcsAt = align8(header.upOffsetsAt + (uint64_t(nodeCount) + 1) * sizeof(uint32_t));
+    header.imageSize = align8(header.upArcsAt + upArcCount * sizeof(UpArc));
+
+    //fill a fresh zeroed buffer, field by field so padding stays zero
+    vector<uint64_t> buffer(header.imageSize / 8, 0);
+    char* image = reinterpret_cast<char*>(buffer.data());
+
+    if (nodeCount != 0)
+        memcpy(image + header.ranksAt, ranks.data(), nodeCount * sizeof(uint32_t));
+    Arc* imageArcs = reinterpret_cast<Arc*>(image + header.arcsAt);
+    for (size_t i = 0; i < arcs.size(); i++)
+    {
+        imageArcs[i].a = arcs[i].a;
+        imageArcs[i].b = arcs[i].b;
+        imageArcs[i].length = arcs[i].length;
+        imageArcs[i].middle = arcs[i].middle;
+        imageArcs[i].first = arcs[i].first;
+        imageArcs[i].second = arcs[i].second;
+    }
+    uint32_t* upOffsets = reinterpret_cast<uint32_t*>(image + header.upOffsetsAt);
+    UpArc* upArcs = reinterpret_cast<UpArc*>(image + header.upArcsAt);
+    uint32_t next = 0;
+    for (uint32_t node = 0; node < nodeCount; node++)
+    {
+        upOffsets[node] = next;
+        for (const UpArc& u : up[node])
+            upArcs[next++] = u;
+    }
+    upOffsets[nodeCount] = next;
+
+    header.checksum = checksumWords(image + sizeof(HierarchyHeader), header.imageSize - sizeof(HierarchyHeader));
+    memcpy(image, &header, sizeof(header));
+
+    //swap in the new image
+    clear();
+    m_buffer.swap(buffer);
+    attach(reinterpret_cast<const char*>(m_buffer.data()), m_buffer.size() * 8);
+}
+
+bool ContractionHierarchy::matches(const StreetGraph& graph) const
+{
+    return !empty() && m_nodeCount == graph.nodeCount() && m_graphChecksum == graph.checksum();
+}
+
+bool ContractionHierarchy::attach(const char* image, size_t size)
+{
+    //check the header describes an image that fits in size bytes before trusting any of it
+    if (size < sizeof(HierarchyHeader))
+        return false;
+    HierarchyHeader header;
+    memcpy(&header, image, sizeof(header));
+    if (memcmp(header.magic, HIERARCHY_MAGIC, sizeof(HIERARCHY_MAGIC)) != 0 ||
+        header.version != HIERARCHY_VERSION || header.byteOrder != HIERARCHY_BYTE_ORDER ||
+        header.imageSize != size)
+        return false;
+    const uint64_t sections[] = { header.ranksAt, header.arcsAt, header.upOffsetsAt, header.upArcsAt, header.imageSize };
+    for (size_t i = 0; i + 1 < sizeof(sections) / sizeof(sections[0]); i++)
+        if (sections[i] % 8 != 0 || sections[i] > sections[i + 1])
+            return false;
+    if (header.arcsAt - header.ranksAt < uint64_t(header.nodeCount) * sizeof(uint32_t) ||
+        header.upOffsetsAt - header.arcsAt < uint64_t(header.arcCount) * sizeof(Arc) ||
+        header.upArcsAt - header.upOffsetsAt < (uint64_t(header.nodeCount) + 1) * sizeof(uint32_t) ||
+        header.imageSize - header.upArcsAt < uint64_t(header.upArcCount) * sizeof(UpArc))
+        return false;
+
+    m_image = image;
+    m_imageSize = size;
+    m_graphChecksum = header.graphChecksum;
+    m_nodeCount = header.nodeCount;
+    m_arcCount = header.arcCount;
+    m_ranks = reinterpret_cast<const uint32_t*>(image + header.ranksAt);
+    m_arcs = reinterpret_cast<const Arc*>(image + header.arcsAt);
+    m_upOffsets = reinterpret_cast<const uint32_t*>(image + header.upOffsetsAt);
+    m_upArcs = reinterpret_cast<const UpArc*>(image + header.upArcsAt);
+    return true;
+}
+
+bool ContractionHierarchy::validate(const StreetGraph& graph) const
+{
+    //every index the queries and unpack follow without checking must be in
+    //range; the sections themselves were checked to fit by attach
+    const HierarchyHeader& header = *reinterpret_cast<const HierarchyHeader*>(m_image);
+    if (m_upOffsets[0] != 0 || m_upOffsets[m_nodeCount] != header.upArcCount)
+        return false;
+    for (uint32_t node = 0; node < m_nodeCount; node++)
+        if (m_upOffsets[node] > m_upOffsets[node + 1])
+            return false;
+    for (uint32_t up = 0; up < header.upArcCount; up++)
+        if (m_upArcs[up].to >= m_nodeCount || m_upArcs[up].arc >= m_arcCount)
+            return false;
+    for (uint32_t index = 0; index < m_arcCount; index++)
+    {
+        const Arc& a = m_arcs[index];
+        if (a.a >= m_nodeCount || a.b >= m_nodeCount)
+            return false;
+        if (a.middle == StreetGraph::NO_NODE)
+        {
+            if (a.first >= graph.edgeCount())
+                return false;
+        }
+        //a shortcut only ever replaces arcs added before it, so unpacking ends
+        else if (a.middle >= m_nodeCount || a.first >= index || a.second >= index)
+            return false;
+    }
+    return true;
+}
+
+bool ContractionHierarchy::save(const string& file) const
+{
+    if (m_image == nullptr)
+        return false;
+    ofstream outf(file, ios::binary | ios::trunc);
+    if (!outf)
+        return false;
+    outf.write(m_image, m_imageSize);
+    return static_cast<bool>(outf);
+}
+
+bool ContractionHierarchy::load(const string& file, const StreetGraph& graph)
+{
+    MappedFile saved;
+    if (!saved.open(file))
+        return false;
+    const char* image = saved.data();
+    size_t size = saved.size();
+
+    //reject truncated, foreign or corrupted files and files for another map,
+    //keeping the current hierarchy
+    if (size < sizeof(HierarchyHeader))
+        return false;
+    HierarchyHeader header;
+    memcpy(&header, image, sizeof(header));
+    if (header.imageSize != size ||
+        checksumWords(image + sizeof(HierarchyHeader), size - sizeof(HierarchyHeader)) != header.checksum)
+        return false;
+    ContractionHierarchy check;
+    if (!check.attach(image, size) || !check.matches(graph) || !check.validate(graph))
+        return false;
+
+    //take over the validated image
+    clear();
+    m_file.swap(saved);
+    return attach(m_file.data(), m_file.size());
+}
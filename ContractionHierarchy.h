@@ -0,0 +1,100 @@
+#ifndef CONTRACTIONHIERARCHY_INCLUDED
+#define CONTRACTIONHIERARCHY_INCLUDED
+
+#include "StreetGraph.h"
+#include "MappedFile.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Contraction Hierarchy over a StreetGraph, built once after the map is loaded.
+//
+// Nodes are contracted one at a time, least important first; contracting a node
+// adds a shortcut between two of its remaining neighbors whenever the path through
+// it is the only shortest one.  A node's rank is its place in that order, and its
+// up arcs are the arcs to the neighbors it still had when it was contracted, which
+// all rank higher.  Every shortest path then climbs to a highest node and comes
+// back down, so a query searches up arcs from both ends and meets at the top.
+//
+// Segments are stored in both directions, so the hierarchy is undirected: an arc
+// joins two nodes either way round and one set of up arcs serves both searches.
+// A shortcut remembers the node it bypasses and the two arcs it replaces, which
+// is what unpack follows to turn it back into street edges.
+//
+// Like StreetGraph, the hierarchy is one flat image, on the heap when built and
+// memory mapped when loaded from a file saved for the same graph.
+class ContractionHierarchy
+{
+public:
+    static const uint32_t NO_ARC = 0xFFFFFFFF;
+
+    struct Arc
+    {
+        uint32_t a;
+        uint32_t b;
+        double   length;
+        uint32_t middle;    // bypassed node, or NO_NODE for a street edge
+        uint32_t first;     // street edge index, or the arc a - middle
+        uint32_t second;    // the arc middle - b, or NO_ARC for a street edge
+    };
+
+    struct UpArc
+    {
+        uint32_t to;        // the higher ranked end
+        uint32_t arc;
+        double   length;
+    };
+
+    ContractionHierarchy();
+    ~ContractionHierarchy();
+
+    bool empty() const { return m_image == nullptr; }
+    uint32_t nodeCount() const { return m_nodeCount; }
+    uint32_t arcCount() const { return m_arcCount; }
+
+    uint32_t rank(uint32_t node) const { return m_ranks[node]; }
+    const Arc& arc(uint32_t index) const { return m_arcs[index]; }
+    const UpArc* upBegin(uint32_t node) const { return m_upArcs + m_upOffsets[node]; }
+    const UpArc* upEnd(uint32_t node) const { return m_upArcs + m_upOffsets[node + 1]; }
+
+    // append the street edges arc stands for, walked starting from its end from
+    void unpack(uint32_t arc, uint32_t from, std::vector<RouteStep>& path) const;
+
+    // contract graph; replaces the current hierarchy
+    void build(const StreetGraph& graph);
+    void clear();
+
+    // whether this hierarchy was built for graph
+    bool matches(const StreetGraph& graph) const;
+
+    // write the image to a file / map a file saved for graph in place of the current hierarchy
+    bool save(const std::string& file) const;
+    bool load(const std::string& file, const StreetGraph& graph);
+
+    // C++11 syntax for preventing copying and assignment
+    ContractionHierarchy(const ContractionHierarchy&) = delete;
+    ContractionHierarchy& operator=(const ContractionHierarchy&) = delete;
+
+private:
+    // image storage: either the heap buffer or a hierarchy file
+    std::vector<uint64_t> m_buffer;
+    MappedFile m_file;
+
+    // views into the image
+    const char* m_image;
+    size_t   m_imageSize;
+    uint64_t m_graphChecksum;
+    uint32_t m_nodeCount;
+    uint32_t m_arcCount;
+    const uint32_t* m_ranks;
+    const Arc*      m_arcs;
+    const uint32_t* m_upOffsets;
+    const UpArc*    m_upArcs;
+
+    bool attach(const char* image, size_t size);
+    bool validate(const StreetGraph& graph) const;
+};
+
+#endif // CONTRACTIONHIERARCHY_INCLUDED
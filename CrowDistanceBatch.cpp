@@ -0,0 +1,105 @@
+#include "CrowDistanceBatch.h"
+#include "provided.h"
+
+#include <cmath>
+#include <algorithm>
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+using namespace std;
+
+namespace
+{
+    const double EARTH_DIAMETER_MILES = 2.0 * 6371.0 / 1.609344;
+}
+
+void CrowDistanceBatch::reserve(size_t points)
+{
+    m_sinHalfLat.reserve(points);
+    m_cosHalfLat.reserve(points);
+    m_sinHalfLon.reserve(points);
+    m_cosHalfLon.reserve(points);
+    m_cosLat.reserve(points);
+}
+
+void CrowDistanceBatch::add(double latitude, double longitude)
+{
+    double lat = deg2rad(latitude);
+    double lon = deg2rad(longitude);
+    m_sinHalfLat.push_back(sin(lat / 2));
+    m_cosHalfLat.push_back(cos(lat / 2));
+    m_sinHalfLon.push_back(sin(lon / 2));
+    m_cosHalfLon.push_back(cos(lon / 2));
+    m_cosLat.push_back(cos(lat));
+}
+
+void CrowDistanceBatch::distancesFrom(size_t from, size_t begin, size_t end, double* out) const
+{
+    const double sa = m_sinHalfLat[from];
+    const double ca = m_cosHalfLat[from];
+    const double so = m_sinHalfLon[from];
+    const double co = m_cosHalfLon[from];
+    const double cl = m_cosLat[from];
+    const double* sinHalfLat = m_sinHalfLat.data();
+    const double* cosHalfLat = m_cosHalfLat.data();
+    const double* sinHalfLon = m_sinHalfLon.data();
+    const double* cosHalfLon = m_cosHalfLon.data();
+    const double* cosLat = m_cosLat.data();
+
+    //first sqrt of the haversine term for every pair, several pairs at a time
+    size_t j = begin;
+#if defined(__AVX__)
+    const __m256d vsa = _mm256_set1_pd(sa), vca = _mm256_set1_pd(ca);
+    const __m256d vso = _mm256_set1_pd(so), vco = _mm256_set1_pd(co);
+    const __m256d vcl = _mm256_set1_pd(cl), one = _mm256_set1_pd(1.0);
+    for (; j + 4 <= end; j += 4)
+    {
+        __m256d u = _mm256_sub_pd(_mm256_mul_pd(_mm256_loadu_pd(sinHalfLat + j), vca),
+                                  _mm256_mul_pd(_mm256_loadu_pd(cosHalfLat + j), vsa));
+        __m256d v = _mm256_sub_pd(_mm256_mul_pd(_mm256_loadu_pd(sinHalfLon + j), vco),
+                                  _mm256_mul_pd(_mm256_loadu_pd(cosHalfLon + j), vso));
+        __m256d h = _mm256_add_pd(_mm256_mul_pd(u, u),
+                                  _mm256_mul_pd(_mm256_mul_pd(vcl, _mm256_loadu_pd(cosLat + j)), _mm256_mul_pd(v, v)));
+        _mm256_storeu_pd(out + (j - begin), _mm256_sqrt_pd(_mm256_min_pd(h, one)));
+    }
+#elif defined(__SSE2__)
+    const __m128d vsa = _mm_set1_pd(sa), vca = _mm_set1_pd(ca);
+    const __m128d vso = _mm_set1_pd(so), vco = _mm_set1_pd(co);
+    const __m128d vcl = _mm_set1_pd(cl), one = _mm_set1_pd(1.0);
+    for (; j + 2 <= end; j += 2)
+    {
+        __m128d u = _mm_sub_pd(_mm_mul_pd(_mm_loadu_pd(sinHalfLat + j), vca),
+                               _mm_mul_pd(_mm_loadu_pd(cosHalfLat + j), vsa));
+        __m128d v = _mm_sub_pd(_mm_mul_pd(_mm_loadu_pd(sinHalfLon + j), vco),
+                               _mm_mul_pd(_mm_loadu_pd(cosHalfLon + j), vso));
+        __m128d h = _mm_add_pd(_mm_mul_pd(u, u),
+                               _mm_mul_pd(_mm_mul_pd(vcl, _mm_loadu_pd(cosLat + j)), _mm_mul_pd(v, v)));
+        _mm_storeu_pd(out + (j - begin), _mm_sqrt_pd(_mm_min_pd(h, one)));
+    }
+#endif
+    //whatever the vector loop left over (everything, without SIMD)
+    for (; j < end; j++)
+    {
+        double u = sinHalfLat[j] * ca - cosHalfLat[j] * sa;
+        double v = sinHalfLon[j] * co - cosHalfLon[j] * so;
+        double h = u * u + cl * cosLat[j] * v * v;
+        out[j - begin] = sqrt(min(h, 1.0));
+    }
+
+    //then the one call that has no vector form
+    for (size_t k = 0; k < end - begin; k++)
+        out[k] = EARTH_DIAMETER_MILES * asin(out[k]);
+}
+
+void CrowDistanceBatch::matrix(vector<double>& out) const
+{
+    //distances are symmetric: work out the upper triangle and mirror it
+    size_t n = size();
+    out.assign(n * n, 0.0);
+    for (size_t i = 0; i + 1 < n; i++)
+    {
+        distancesFrom(i, i + 1, n, out.data() + i * n + i + 1);
+        for (size_t j = i + 1; j < n; j++)
+            out[j * n + i] = out[i * n + j];
+    }
+}
@@ -1,10 +1,328 @@
 #include "provided.h"
+#include "StreetGraph.h"
+#include "CrowDistanceBatch.h"
 #include <vector>
 #include <algorithm>
-#include <random>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <math.h>  
 using namespace std;
 
+namespace
+{
+    //distances between every pair of stops: stop 0 is the depot and stop i is
+    //deliveries[i-1]; the distance from a to b is at [a * stops + b]
+    struct DistanceMatrix
+    {
+        int stops;
+        vector<double> distance;
+        double operator()(int from, int to) const { return distance[from * stops + to]; }
+    };
+
+    //changes smaller than this are rounding noise, not improvements
+    const double EPSILON = 1e-9;
+
+    // Local search moves on a tour of stop numbers.  tour[0] is the depot, which
+    // stays put, and the tour goes back to it after the last stop.  Each move's
+    // change in length comes from the handful of distances it touches, so trying
+    // a move is O(1) however long the tour is; only moves that are taken cost more.
+    // Reversing a stretch of the tour assumes d(a,b) == d(b,a), which holds for
+    // crow distances and for road distances (every segment runs both ways).
+    class TourMoves
+    {
+    public:
+        TourMoves(const DistanceMatrix& matrix, vector<int>& tour)
+            :d(matrix), t(tour), n(static_cast<int>(tour.size()))
+        {
+        }
+
+        //2-opt: reverse the stops at positions i..j, 1 <= i < j < n
+        double twoOptDelta(int i, int j) const
+        {
+            int a = t[i - 1];
+            int b = at(j + 1);
+            return d(a, t[j]) + d(t[i], b) - d(a, t[i]) - d(t[j], b);
+        }
+        void twoOpt(int i, int j)
+        {
+            reverse(t.begin() + i, t.begin() + j + 1);
+        }
+
+        //Or-opt: move the length stops starting at position i to just after position k,
+        //optionally reversed; k must not be i-1 or inside the moved stretch
+        double orOptDelta(int i, int length, int k, bool reversed) const
+        {
+            int p = t[i - 1];
+            int q = at(i + length);
+            int first = t[i];
+            int last = t[i + length - 1];
+            int x = t[k];
+            int y = at(k + 1);
+            double removed = d(p, q) - d(p, first) - d(last, q) - d(x, y);
+            if (reversed)
+                return removed + d(x, last) + d(first, y);
+            return removed + d(x, first) + d(last, y);
+        }
+        void orOpt(int i, int length, int k, bool reversed)
+        {
+            vector<int> moved(t.begin() + i, t.begin() + i + length);
+            if (reversed)
+                reverse(moved.begin(), moved.end());
+            t.erase(t.begin() + i, t.begin() + i + length);
+            //positions after the stretch moved down when it was taken out
+            int insertAt = k < i ? k + 1 : k + 1 - length;
+            t.insert(t.begin() + insertAt, moved.begin(), moved.end());
+        }
+
+        //swap the stops at positions i and j, 1 <= i < j < n
+        double swapDelta(int i, int j) const
+        {
+            int a = t[i - 1];
+            int e = at(j + 1);
+            if (j == i + 1)
+                return d(a, t[j]) + d(t[j], t[i]) + d(t[i], e) - d(a, t[i]) - d(t[i], t[j]) - d(t[j], e);
+            int b = t[i + 1];
+            int c = t[j - 1];
+            return d(a, t[j]) + d(t[j], b) + d(c, t[i]) + d(t[i], e)
+                - d(a, t[i]) - d(t[i], b) - d(c, t[j]) - d(t[j], e);
+        }
+        void swapStops(int i, int j)
+        {
+            swap(t[i], t[j]);
+        }
+
+        //take improving moves until there are none left (a 2-opt / Or-opt / swap local
+        //optimum), and return how many were taken
+        long long descend();
+
+    private:
+        const DistanceMatrix& d;
+        vector<int>& t;
+        int n;
+
+        int at(int position) const { return t[position == n ? 0 : position]; }
+    };
+
+    long long TourMoves::descend()
+    {
+        long long taken = 0;
+        bool improved = true;
+        while (improved)
+        {
+            improved = false;
+            for (int i = 1; i < n; i++)
+            {
+                for (int j = i + 1; j < n; j++)
+                {
+                    if (twoOptDelta(i, j) < -EPSILON)
+                    {
+                        twoOpt(i, j);
+                        improved = true;
+                        taken++;
+                    }
+                    if (swapDelta(i, j) < -EPSILON)
+                    {
+                        swapStops(i, j);
+                        improved = true;
+                        taken++;
+                    }
+                }
+            }
+            for (int length = 1; length <= 3; length++)
+            {
+                for (int i = 1; i + length <= n; i++)
+                {
+                    for (int k = 0; k < n; k++)
+                    {
+                        if (k >= i - 1 && k < i + length)
+                            continue;
+                        for (int reversed = 0; reversed < (length > 1 ? 2 : 1); reversed++)
+                        {
+                            if (orOptDelta(i, length, k, reversed != 0) < -EPSILON)
+                            {
+                                orOpt(i, length, k, reversed != 0);
+                                improved = true;
+                                taken++;
+                                break;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        return taken;
+    }
+
+    // Small, fast PRNG (xoshiro256**) for one annealing chain; its state is seeded
+    // by running splitmix64 from (seed, chain), so each chain gets its own stream
+    // and a given seed always produces the same streams.
+    class ChainRandom
+    {
+    public:
+        ChainRandom(uint64_t seed, uint64_t chain)
+        {
+            uint64_t x = seed ^ (chain * 0x9E3779B97F4A7C15ull);
+            for (int i = 0; i < 4; i++)
+                m_state[i] = splitmix(x);
+        }
+        uint64_t next()
+        {
+            uint64_t result = rotate(m_state[1] * 5, 7) * 9;
+            uint64_t t = m_state[1] << 17;
+            m_state[2] ^= m_state[0];
+            m_state[3] ^= m_state[1];
+            m_state[1] ^= m_state[2];
+            m_state[0] ^= m_state[3];
+            m_state[2] ^= t;
+            m_state[3] = rotate(m_state[3], 45);
+            return result;
+        }
+        //uniform in [0, 1)
+        double uniform() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+        //uniform in [low, high]
+        int pick(int low, int high)
+        {
+            uint64_t range = uint64_t(high - low) + 1;
+            return low + static_cast<int>(((next() >> 32) * range) >> 32);
+        }
+    private:
+        uint64_t m_state[4];
+        static uint64_t rotate(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+        static uint64_t splitmix(uint64_t& x)
+        {
+            uint64_t z = (x += 0x9E3779B97F4A7C15ull);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            return z ^ (z >> 31);
+        }
+    };
+
+    //batches of up to this many deliveries are solved exactly unless set otherwise,
+    //and never more than MAX_EXACT_STOPS (the table doubles with every stop)
+    const int DEFAULT_EXACT_STOPS = 12;
+    const int MAX_EXACT_STOPS = 16;
+
+    //the seed used until setSeed is called
+    const uint64_t DEFAULT_SEED = 20200308;
+
+    //annealing tries this many moves per stop squared, within these limits
+    const int ANNEALING_MOVES_PER_STOP_SQUARED = 200;
+    const int MIN_ANNEALING_MOVES = 20000;
+    const int MAX_ANNEALING_MOVES = 4000000;
+
+    //more deliveries than this are split into clusters of about this many unless
+    //set otherwise; clusters are never made smaller than MIN_CLUSTER_STOPS
+    const int DEFAULT_CLUSTER_STOPS = 200;
+    const int MIN_CLUSTER_STOPS = 8;
+
+    //most rounds of k-means when clustering
+    const int KMEANS_ROUNDS = 20;
+
+    // The k-means cluster centres bucketed in a grid of square cells, about one
+    // centre per cell, so finding a stop's nearest centre only looks at the rings
+    // of cells around the stop instead of at every centre.
+    class CentreGrid
+    {
+    public:
+        CentreGrid(const vector<double>& x, const vector<double>& y);
+        //the centre nearest (px, py); current if it is one of the nearest, else the
+        //lowest numbered of them, just as checking every centre in turn would pick
+        int nearest(double px, double py, int current) const;
+    private:
+        const vector<double>& m_x;
+        const vector<double>& m_y;
+        double m_minX, m_minY;
+        double m_cell;
+        int m_cols, m_rows;
+        vector<int> m_offsets;    // m_centres[m_offsets[cell]..m_offsets[cell + 1]) are in cell
+        vector<int> m_centres;
+
+        double distance2(int c, double px, double py) const
+        {
+            return (px - m_x[c]) * (px - m_x[c]) + (py - m_y[c]) * (py - m_y[c]);
+        }
+        int column(double px) const { return min(m_cols - 1, max(0, static_cast<int>((px - m_minX) / m_cell))); }
+        int row(double py) const { return min(m_rows - 1, max(0, static_cast<int>((py - m_minY) / m_cell))); }
+    };
+
+    CentreGrid::CentreGrid(const vector<double>& x, const vector<double>& y)
+        :m_x(x), m_y(y)
+    {
+        int k = static_cast<int>(x.size());
+        m_minX = *min_element(x.begin(), x.end());
+        m_minY = *min_element(y.begin(), y.end());
+        double width = *max_element(x.begin(), x.end()) - m_minX;
+        double height = *max_element(y.begin(), y.end()) - m_minY;
+        //square cells of about one centre each, but never more than k across, so
+        //a long thin spread of centres doesn't make a huge grid
+        m_cell = max(sqrt(width * height / k), max(width, height) / k);
+        if (m_cell <= 0)
+            m_cell = 1;
+        m_cols = static_cast<int>(width / m_cell) + 1;
+        m_rows = static_cast<int>(height / m_cell) + 1;
+
+        //bucket the centres by cell
+        m_offsets.assign(size_t(m_cols) * m_rows + 1, 0);
+        vector<int> cellOf(k);
+        for (int c = 0; c < k; c++)
+        {
+            cellOf[c] = row(y[c]) * m_cols + column(x[c]);
+            m_offsets[cellOf[c] + 1]++;
+        }
+        for (size_t cell = 1; cell < m_offsets.size(); cell++)
+            m_offsets[cell] += m_offsets[cell - 1];
+        m_centres.resize(k);
+        vector<int> next(m_offsets.begin(), m_offsets.end() - 1);
+        for (int c = 0; c < k; c++)
+            m_centres[next[cellOf[c]]++] = c;
+    }
+
+    int CentreGrid::nearest(double px, double py, int current) const
+    {
+        int best = current;
+        double closest = distance2(current, px, py);
+        int col = column(px);
+        int rw = row(py);
+        //centres in ring d of cells around the stop's cell are at least (d - 1) cells
+        //away, even from a stop off the grid; stop once no ring can hold a nearer one
+        for (int d = 0; ; d++)
+        {
+            double reach = (d - 1) * m_cell;
+            if (d > 0 && closest < reach * reach)
+                break;
+            if (col - d < 0 && col + d >= m_cols && rw - d < 0 && rw + d >= m_rows)
+                break;
+            for (int r = max(0, rw - d); r <= min(m_rows - 1, rw + d); r++)
+            {
+                //the whole row at the ring's top and bottom, just its ends in between
+                int step = (r == rw - d || r == rw + d) ? 1 : max(1, 2 * d);
+                for (int c = col - d; c <= col + d; c += step)
+                {
+                    if (c < 0 || c >= m_cols)
+                        continue;
+                    int cell = r * m_cols + c;
+                    for (int i = m_offsets[cell]; i < m_offsets[cell + 1]; i++)
+                    {
+                        int centre = m_centres[i];
+                        double dist = distance2(centre, px, py);
+                        if (dist < closest || (dist == closest && best != current && centre < best))
+                        {
+                            closest = dist;
+                            best = centre;
+                        }
+                    }
+                }
+            }
+        }
+        return best;
+    }
+
+    //boundary repair reorders this many stops either side of each join between clusters
+    const int REPAIR_REACH = 6;
+}
+
 class DeliveryOptimizerImpl
 {
 public:
@@ -15,38 +333,553 @@ public:
         vector<DeliveryRequest>& deliveries,
         double& oldCrowDistance,
         double& newCrowDistance) const;
+    void setDistanceMetric(DistanceMetric metric) { m_metric = metric; }
+    void setAnnealing(bool anneal) { m_anneal = anneal; }
+    void setAnnealingChains(int chains) { m_chains = chains; }
+    void setSeed(uint64_t seed) { m_seed = seed; }
+    void setExactThreshold(int stops) { m_exactStops = min(max(stops, 0), MAX_EXACT_STOPS); }
+    void setClusterSize(int stops) { m_clusterStops = stops > 0 ? max(stops, MIN_CLUSTER_STOPS) : 0; }
+    void setThreadLimit(int threads) { m_threads = max(threads, 0); }
+    void setStats(PlannerStats* stats) { m_stats = stats; }
 private:
-    double totalDist(const GeoCoord& depot, vector<DeliveryRequest>& deliveries) const;
+    const StreetMap* streets;
+    DistanceMetric m_metric;
+    bool m_anneal;
+    int m_chains;
+    uint64_t m_seed;
+    int m_exactStops;
+    int m_clusterStops;
+    int m_threads;
+    PlannerStats* m_stats;
+
+    void crowDistances(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries, DistanceMatrix& matrix) const;
+    bool roadDistances(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries, DistanceMatrix& matrix) const;
+    bool distances(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries, bool road, DistanceMatrix& matrix, PlannerStats& work) const;
+    bool reachable(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries, PlannerStats& work) const;
+    void legs(const GeoCoord& from, const vector<DeliveryRequest>& to, bool road, vector<double>& distance, PlannerStats& work) const;
+    double crowLength(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries) const;
+    int threadLimit() const { return m_threads > 0 ? m_threads : max(1, static_cast<int>(thread::hardware_concurrency())); }
+    double totalDist(const vector<int>& tour, const DistanceMatrix& matrix) const;
+    double anneal(vector<int>& tour, const DistanceMatrix& matrix, ChainRandom& random, long long& tried) const;
+    void annealChains(vector<int>& tour, const DistanceMatrix& matrix, int threads, PlannerStats& work) const;
+    void solveExactly(vector<int>& tour, const DistanceMatrix& matrix) const;
+    void solve(vector<int>& tour, const DistanceMatrix& matrix, int threads, PlannerStats& work) const;
+    void solveInClusters(const GeoCoord& depot, vector<DeliveryRequest>& deliveries, PlannerStats& work) const;
+    void repairJoin(vector<DeliveryRequest>& stops, int first, int last, bool road, PlannerStats& work) const;
 };
 
-double DeliveryOptimizerImpl::totalDist(const GeoCoord& depot, vector<DeliveryRequest>& deliveries) const
+void DeliveryOptimizerImpl::crowDistances(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries, DistanceMatrix& matrix) const
 {
-    //calculates total crow distance between all deliveries points including from and back to depot
+    //every pair at once, from each stop's sines and cosines worked out just once
+    CrowDistanceBatch batch;
+    batch.reserve(deliveries.size() + 1);
+    batch.add(depot.latitude, depot.longitude);
+    for (const DeliveryRequest& d : deliveries)
+        batch.add(d.location.latitude, d.location.longitude);
+    matrix.stops = static_cast<int>(batch.size());
+    batch.matrix(matrix.distance);
+}
 
-    double crowDist = 0;
-    //iterate through deliveries
-    auto deliverIt = deliveries.begin();
-    auto deliverItPrev = deliveries.begin();
-    for (; deliverIt != deliveries.end(); ++deliverIt)
+bool DeliveryOptimizerImpl::roadDistances(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries, DistanceMatrix& matrix) const
+{
+    //every stop has to be on the map
+    const StreetGraph& graph = streets->graph();
+    vector<uint32_t> nodes;
+    nodes.push_back(graph.findNode(depot));
+    for (const DeliveryRequest& d : deliveries)
+        nodes.push_back(graph.findNode(d.location));
+    for (uint32_t node : nodes)
+        if (node == StreetGraph::NO_NODE)
+            return false;
+
+    //one search from each stop finds its distances to all the others at once
+    matrix.stops = static_cast<int>(nodes.size());
+    matrix.distance.assign(matrix.stops * matrix.stops, 0.0);
+    vector<double> row;
+    for (int from = 0; from < matrix.stops; from++)
     {
-        //add depot to first location
-        if (deliverIt == deliveries.begin())
-            crowDist += distanceEarthMiles(depot, (*deliverIt).location);
-        //location to location
-        else
-            crowDist += distanceEarthMiles((*deliverItPrev).location, (*deliverIt).location);
-        //update prev iterator
-        deliverItPrev = deliverIt;
+        graph.distancesTo(nodes[from], nodes, row);
+        for (int to = 0; to < matrix.stops; to++)
+        {
+            //some stop can't be reached, so no order is drivable anyway
+            if (row[to] == INFINITY)
+                return false;
+            matrix.distance[from * matrix.stops + to] = row[to];
+        }
+    }
+    return true;
+}
+
+bool DeliveryOptimizerImpl::distances(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries, bool road, DistanceMatrix& matrix, PlannerStats& work) const
+{
+    //road distances if asked for and available, otherwise crow distances
+    bool used = road && roadDistances(depot, deliveries, matrix);
+    if (used)
+        work.distanceSearches += matrix.stops;
+    else
+        crowDistances(depot, deliveries, matrix);
+    work.bytesAllocated += matrix.distance.capacity() * sizeof(double);
+    return used;
+}
+
+bool DeliveryOptimizerImpl::reachable(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries, PlannerStats& work) const
+{
+    //every stop on the map and connected to the depot, so any two stops are connected
+    const StreetGraph& graph = streets->graph();
+    uint32_t source = graph.findNode(depot);
+    if (source == StreetGraph::NO_NODE)
+        return false;
+    vector<uint32_t> nodes;
+    for (const DeliveryRequest& d : deliveries)
+    {
+        nodes.push_back(graph.findNode(d.location));
+        if (nodes.back() == StreetGraph::NO_NODE)
+            return false;
+    }
+    vector<double> distance;
+    graph.distancesTo(source, nodes, distance);
+    work.distanceSearches++;
+    for (double miles : distance)
+        if (miles == INFINITY)
+            return false;
+    return true;
+}
+
+void DeliveryOptimizerImpl::legs(const GeoCoord& from, const vector<DeliveryRequest>& to, bool road, vector<double>& distance, PlannerStats& work) const
+{
+    //distances from one point to each of the stops in to
+    distance.clear();
+    if (road)
+    {
+        const StreetGraph& graph = streets->graph();
+        vector<uint32_t> nodes;
+        for (const DeliveryRequest& d : to)
+            nodes.push_back(graph.findNode(d.location));
+        graph.distancesTo(graph.findNode(from), nodes, distance);
+        work.distanceSearches++;
+        return;
+    }
+    for (const DeliveryRequest& d : to)
+        distance.push_back(distanceEarthMiles(from, d.location));
+}
+
+double DeliveryOptimizerImpl::crowLength(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries) const
+{
+    //crow distance from the depot through the deliveries in order and back
+    double dist = 0;
+    GeoCoord at = depot;
+    for (const DeliveryRequest& d : deliveries)
+    {
+        dist += distanceEarthMiles(at, d.location);
+        at = d.location;
     }
+    return dist + distanceEarthMiles(at, depot);
+}
+
+double DeliveryOptimizerImpl::totalDist(const vector<int>& tour, const DistanceMatrix& matrix) const
+{
+    //calculates total distance between all deliveries points including from and back to depot
+
+    double dist = 0;
+    for (size_t i = 0; i + 1 < tour.size(); i++)
+        dist += matrix(tour[i], tour[i + 1]);
     //from last location back to depot
-    crowDist += distanceEarthMiles((*deliverItPrev).location, depot);
+    dist += matrix(tour.back(), tour[0]);
 
-    return crowDist;
+    return dist;
 }
 
-DeliveryOptimizerImpl::DeliveryOptimizerImpl(const StreetMap* sm)
+// Simulated annealing over random 2-opt, Or-opt and swap moves.  The temperature
+// starts where a move that adds an average leg is accepted half the time and cools
+// geometrically to a thousandth of that.  tour becomes the best tour seen, and its
+// length is returned; tried counts the moves tried.
+double DeliveryOptimizerImpl::anneal(vector<int>& tour, const DistanceMatrix& matrix, ChainRandom& random, long long& tried) const
 {
+    int n = static_cast<int>(tour.size());
+    TourMoves moves(matrix, tour);
 
+    double averageLeg = totalDist(tour, matrix) / n;
+    double temp = averageLeg / log(2.0);
+    long long steps = min<long long>(MAX_ANNEALING_MOVES, max<long long>(MIN_ANNEALING_MOVES, (long long)ANNEALING_MOVES_PER_STOP_SQUARED * n * n));
+    double coolingRate = pow(1e-3, 1.0 / steps);
+
+    auto pick = [&](int low, int high) { return random.pick(low, high); };
+
+    double current = totalDist(tour, matrix);
+    double bestDistance = current;
+    vector<int> best = tour;
+    for (long long step = 0; step < steps; step++, temp *= coolingRate)
+    {
+        tried++;
+        //pick a random move and work out what it would change
+        int kind = pick(0, 2);
+        int i = 0, j = 0, length = 0, k = 0;
+        bool reversed = false;
+        double delta;
+        if (kind == 2 && n >= 4)
+        {
+            //Or-opt: a stretch of up to 3 stops, to anywhere outside it
+            length = pick(1, min(3, n - 2));
+            i = pick(1, n - length);
+            k = pick(0, n - length - 2);
+            if (k >= i - 1)
+                k += length + 1;
+            reversed = length > 1 && pick(0, 1) == 1;
+            delta = moves.orOptDelta(i, length, k, reversed);
+        }
+        else
+        {
+            i = pick(1, n - 2);
+            j = pick(i + 1, n - 1);
+            delta = kind == 0 ? moves.twoOptDelta(i, j) : moves.swapDelta(i, j);
+        }
+
+        //always take improvements, and worse moves with a chance that shrinks as it cools
+        if (delta >= 0 && random.uniform() >= exp(-delta / temp))
+            continue;
+        if (kind == 2 && n >= 4)
+            moves.orOpt(i, length, k, reversed);
+        else if (kind == 0)
+            moves.twoOpt(i, j);
+        else
+            moves.swapStops(i, j);
+        current += delta;
+
+        // Keep track of the best solution found
+        if (current < bestDistance - EPSILON)
+        {
+            bestDistance = current;
+            best = tour;
+        }
+    }
+    tour = best;
+    return bestDistance;
+}
+
+// Run independent annealing chains from the same starting tour, on at most threads
+// threads, each with its own random stream, and keep the best result.  Ties go to
+// the lowest numbered chain, so the outcome depends only on the seed and the number
+// of chains, never on how many threads ran them or how they were scheduled.
+void DeliveryOptimizerImpl::annealChains(vector<int>& tour, const DistanceMatrix& matrix, int threads, PlannerStats& work) const
+{
+    int chains = m_chains > 0 ? m_chains : max(1, static_cast<int>(thread::hardware_concurrency()));
+    vector<vector<int>> tours(chains, tour);
+    vector<double> lengths(chains);
+    vector<long long> tried(chains, 0);
+    threads = max(1, min(threads, chains));
+    //thread t runs chains t, t + threads, ...
+    auto run = [&](int first) {
+        for (int chain = first; chain < chains; chain += threads)
+        {
+            ChainRandom random(m_seed, chain);
+            lengths[chain] = anneal(tours[chain], matrix, random, tried[chain]);
+        }
+    };
+
+    //the first share runs on this thread
+    vector<thread> workers;
+    for (int t = 1; t < threads; t++)
+        workers.push_back(thread(run, t));
+    run(0);
+    for (thread& worker : workers)
+        worker.join();
+    for (long long moves : tried)
+        work.annealingMoves += moves;
+
+    int best = 0;
+    for (int chain = 1; chain < chains; chain++)
+        if (lengths[chain] < lengths[best])
+            best = chain;
+    tour = tours[best];
+}
+
+// Held-Karp dynamic programming: shortest[mask * n + last] is the length of the
+// shortest path from the depot through exactly the deliveries in mask, ending at
+// delivery last (deliveries numbered from 0 here, so delivery i is stop i + 1).
+// Rows are indexed by mask, and every subset is finished before any larger one
+// is extended, so each row is read once, front to back.  O(2^n * n^2) time.
+void DeliveryOptimizerImpl::solveExactly(vector<int>& tour, const DistanceMatrix& matrix) const
+{
+    int n = static_cast<int>(tour.size()) - 1;
+    size_t subsets = size_t(1) << n;
+    vector<double> shortest(subsets * n, INFINITY);
+    vector<uint8_t> previous(subsets * n, 0);
+    for (int i = 0; i < n; i++)
+        shortest[(size_t(1) << i) * n + i] = matrix(0, i + 1);
+
+    for (size_t mask = 1; mask < subsets; mask++)
+    {
+        const double* row = &shortest[mask * n];
+        for (int last = 0; last < n; last++)
+        {
+            if (row[last] == INFINITY)
+                continue;
+            //extend the path by one more delivery
+            for (int next = 0; next < n; next++)
+            {
+                if (mask & (size_t(1) << next))
+                    continue;
+                size_t cell = (mask | (size_t(1) << next)) * n + next;
+                double length = row[last] + matrix(last + 1, next + 1);
+                if (length < shortest[cell])
+                {
+                    shortest[cell] = length;
+                    previous[cell] = static_cast<uint8_t>(last);
+                }
+            }
+        }
+    }
+
+    //close the loop back to the depot, then walk the choices backwards
+    size_t mask = subsets - 1;
+    int last = 0;
+    for (int i = 1; i < n; i++)
+        if (shortest[mask * n + i] + matrix(i + 1, 0) < shortest[mask * n + last] + matrix(last + 1, 0))
+            last = i;
+    for (int position = n; position >= 1; position--)
+    {
+        tour[position] = last + 1;
+        int before = previous[mask * n + last];
+        mask &= ~(size_t(1) << last);
+        last = before;
+    }
+}
+
+void DeliveryOptimizerImpl::solve(vector<int>& tour, const DistanceMatrix& matrix, int threads, PlannerStats& work) const
+{
+    //with fewer than two deliveries there is only one order; small batches are
+    //solved exactly, bigger ones by annealing and local search
+    if (tour.size() >= 3 && static_cast<int>(tour.size()) - 1 <= m_exactStops)
+        solveExactly(tour, matrix);
+    else if (tour.size() >= 3)
+    {
+        if (m_anneal)
+            annealChains(tour, matrix, threads, work);
+        //finish at a local optimum, so no single move could still shorten the tour
+        work.localSearchMoves += TourMoves(matrix, tour).descend();
+    }
+}
+
+// Cluster first, route second, for more deliveries than one tour can be ordered
+// in reasonable time.  The deliveries are grouped by k-means into clusters of
+// about m_clusterStops, starting from a sweep by bearing around the depot, and the
+// clusters are visited in the order of the shortest tour through their centres.
+// Each cluster is ordered as a loop of its own, the clusters in parallel.  The
+// loops are then joined, each one opened at whichever edge makes the cheapest way
+// in from where the previous one was left, and the stops around each join are
+// reordered to repair what cutting the tour into pieces cost.  Every step but
+// k-means is linear in the number of deliveries, and k-means is linear in the
+// number of deliveries times the number of clusters.
+void DeliveryOptimizerImpl::solveInClusters(const GeoCoord& depot, vector<DeliveryRequest>& deliveries, PlannerStats& work) const
+{
+    int n = static_cast<int>(deliveries.size());
+    //road distances only if every leg between stops has one
+    bool road = m_metric == ROAD_DISTANCE && streets != nullptr && reachable(depot, deliveries, work);
+
+    //sort by bearing (on a flat map squashed east-west to match the latitude) and
+    //start just after the widest gap, so the first and last runs are far apart
+    double squash = cos(deg2rad(depot.latitude));
+    vector<double> x, y, bearing;
+    vector<int> order;
+    for (int i = 0; i < n; i++)
+    {
+        x.push_back((deliveries[i].location.longitude - depot.longitude) * squash);
+        y.push_back(deliveries[i].location.latitude - depot.latitude);
+        bearing.push_back(atan2(y[i], x[i]));
+        order.push_back(i);
+    }
+    stable_sort(order.begin(), order.end(), [&](int a, int b) { return bearing[a] < bearing[b]; });
+    int start = 0;
+    double widest = bearing[order[0]] + deg2rad(360) - bearing[order[n - 1]];
+    for (int i = 1; i < n; i++)
+    {
+        if (bearing[order[i]] - bearing[order[i - 1]] > widest)
+        {
+            widest = bearing[order[i]] - bearing[order[i - 1]];
+            start = i;
+        }
+    }
+    rotate(order.begin(), order.begin() + start, order.end());
+
+    //k-means, starting from the centres of equal runs of the sweep; wedges from the
+    //sweep alone reach from the depot to the edge of the map, and a tour through
+    //each of those goes out and back again
+    int clusters = (n + m_clusterStops - 1) / m_clusterStops;
+    vector<int> cluster(n);
+    for (int i = 0; i < n; i++)
+        cluster[order[i]] = static_cast<int>(static_cast<long long>(i) * clusters / n);
+    vector<double> centreX(clusters), centreY(clusters);
+    for (int round = 0; ; round++)
+    {
+        vector<double> sumX(clusters, 0.0), sumY(clusters, 0.0);
+        vector<int> count(clusters, 0);
+        for (int i = 0; i < n; i++)
+        {
+            sumX[cluster[i]] += x[i];
+            sumY[cluster[i]] += y[i];
+            count[cluster[i]]++;
+        }
+        for (int c = 0; c < clusters; c++)
+        {
+            //an emptied cluster keeps its old centre
+            if (count[c] > 0)
+            {
+                centreX[c] = sumX[c] / count[c];
+                centreY[c] = sumY[c] / count[c];
+            }
+        }
+        if (round == KMEANS_ROUNDS)
+            break;
+
+        //each stop to its nearest centre, found through a grid of them so a round
+        //costs about the same per stop however many clusters there are
+        CentreGrid grid(centreX, centreY);
+        bool moved = false;
+        for (int i = 0; i < n; i++)
+        {
+            int nearest = grid.nearest(x[i], y[i], cluster[i]);
+            moved = moved || nearest != cluster[i];
+            cluster[i] = nearest;
+        }
+        if (!moved)
+            break;
+    }
+
+    //visit the clusters in the order of the shortest tour from the depot through their centres
+    CrowDistanceBatch batch;
+    batch.add(depot.latitude, depot.longitude);
+    for (int c = 0; c < clusters; c++)
+        batch.add(depot.latitude + centreY[c], depot.longitude + centreX[c] / squash);
+    DistanceMatrix between;
+    between.stops = clusters + 1;
+    batch.matrix(between.distance);
+    vector<int> visit;
+    for (int c = 0; c <= clusters; c++)
+        visit.push_back(c);
+    solve(visit, between, threadLimit(), work);
+    vector<int> position(clusters);
+    for (int k = 1; k <= clusters; k++)
+        position[visit[k] - 1] = k - 1;
+
+    //members in sweep order, dropping any clusters left empty
+    vector<vector<DeliveryRequest>> members(clusters);
+    for (int i : order)
+        members[position[cluster[i]]].push_back(deliveries[i]);
+    members.erase(remove_if(members.begin(), members.end(),
+                            [](const vector<DeliveryRequest>& stops) { return stops.empty(); }), members.end());
+    clusters = static_cast<int>(members.size());
+
+    //order each cluster as a loop through its own stops, with its first member standing
+    //in for the depot, so stop s of a cluster's matrix and loop is members[c][s]
+    vector<DistanceMatrix> matrices(clusters);
+    vector<vector<int>> loops(clusters);
+    vector<PlannerStats> clusterWork(clusters);
+    //the thread limit is shared out between the clusters being ordered at once
+    int threads = min(clusters, threadLimit());
+    int threadsEach = max(1, threadLimit() / threads);
+    atomic<int> nextCluster(0);
+    auto orderClusters = [&]() {
+        for (int c = nextCluster++; c < clusters; c = nextCluster++)
+        {
+            vector<DeliveryRequest> rest(members[c].begin() + 1, members[c].end());
+            distances(members[c][0].location, rest, road, matrices[c], clusterWork[c]);
+            for (int s = 0; s < matrices[c].stops; s++)
+                loops[c].push_back(s);
+            solve(loops[c], matrices[c], threadsEach, clusterWork[c]);
+        }
+    };
+    vector<thread> workers;
+    for (int i = 1; i < threads; i++)
+        workers.push_back(thread(orderClusters));
+    orderClusters();
+    for (thread& worker : workers)
+        worker.join();
+    for (const PlannerStats& counted : clusterWork)
+        work += counted;
+
+    //open each loop where getting in from the last stop so far, in place of one of
+    //its own edges, and heading out towards the next cluster's centre (or the depot)
+    //costs least, and walk it from there
+    vector<DeliveryRequest> joined;
+    vector<int> joins;
+    vector<double> entry;
+    for (int c = 0; c < clusters; c++)
+    {
+        const vector<int>& loop = loops[c];
+        int m = static_cast<int>(loop.size());
+        legs(joined.empty() ? depot : joined.back().location, members[c], road, entry, work);
+        double nextLat = depot.latitude;
+        double nextLon = depot.longitude;
+        if (c + 1 < clusters)
+        {
+            nextLat = nextLon = 0;
+            for (const DeliveryRequest& d : members[c + 1])
+            {
+                nextLat += d.location.latitude / members[c + 1].size();
+                nextLon += d.location.longitude / members[c + 1].size();
+            }
+        }
+        int first = 0;
+        int step = 1;
+        double cheapest = INFINITY;
+        for (int i = 0; i < m; i++)
+        {
+            for (int direction = 1; direction >= -1; direction -= 2)
+            {
+                int last = loop[(i - direction + m) % m];
+                const GeoCoord& leave = members[c][last].location;
+                double cost = entry[loop[i]] - (m > 1 ? matrices[c](last, loop[i]) : 0) +
+                    distanceEarthMiles(leave.latitude, leave.longitude, nextLat, nextLon);
+                if (cost < cheapest - EPSILON)
+                {
+                    cheapest = cost;
+                    first = i;
+                    step = direction;
+                }
+            }
+        }
+        if (c > 0)
+            joins.push_back(static_cast<int>(joined.size()));
+        for (int k = 0; k < m; k++)
+            joined.push_back(members[c][loop[((first + k * step) % m + m) % m]]);
+    }
+
+    for (int join : joins)
+        repairJoin(joined, max(0, join - REPAIR_REACH - 1), min(n - 1, join + REPAIR_REACH), road, work);
+    deliveries = joined;
+}
+
+// Reorder stops[first+1..last-1] to shorten the path from stops[first] to stops[last].
+// The path is made a loop for TourMoves by joining its two ends with an edge so
+// short that any order without it is longer than every order with it; local search
+// never takes a move that makes the loop longer, so the ends stay pinned.
+void DeliveryOptimizerImpl::repairJoin(vector<DeliveryRequest>& stops, int first, int last, bool road, PlannerStats& work) const
+{
+    if (last - first < 3)
+        return;
+    vector<DeliveryRequest> window(stops.begin() + first + 1, stops.begin() + last + 1);
+    DistanceMatrix matrix;
+    distances(stops[first].location, window, road, matrix, work);
+
+    int end = matrix.stops - 1;
+    double longest = *max_element(matrix.distance.begin(), matrix.distance.end());
+    matrix.distance[end] = matrix.distance[end * matrix.stops] = -(longest * matrix.stops + 1);
+    vector<int> tour;
+    for (int s = 0; s <= end; s++)
+        tour.push_back(s);
+    work.localSearchMoves += TourMoves(matrix, tour).descend();
+    //the loop may come back round the other way
+    if (tour[1] == end)
+        reverse(tour.begin() + 1, tour.end());
+
+    for (int s = 1; s < end; s++)
+        stops[first + s] = window[tour[s] - 1];
+}
+
+DeliveryOptimizerImpl::DeliveryOptimizerImpl(const StreetMap* sm)
+    :streets(sm), m_metric(ROAD_DISTANCE), m_anneal(true), m_chains(1), m_seed(DEFAULT_SEED),
+    m_exactStops(DEFAULT_EXACT_STOPS), m_clusterStops(DEFAULT_CLUSTER_STOPS), m_threads(0), m_stats(nullptr)
+{
 }
 
 DeliveryOptimizerImpl::~DeliveryOptimizerImpl()
@@ -59,61 +892,37 @@ void DeliveryOptimizerImpl::optimizeDeliveryOrder(
     double& oldCrowDistance,
     double& newCrowDistance) const
 {
-    //set old crow dist to initial order's total
-    oldCrowDistance = totalDist(depot, deliveries);
-
-    //Set initial temp
-    double temp = 1000000;
-
-    //Cooling rate
-    double coolingRate = 0.003;
-
-    // Assume best solution is the current solution
-    vector<DeliveryRequest> best = deliveries;
-
-    // Loop until system has cooled
-    while (temp > 1) {
-        
-        //make new deliveries path
-        vector<DeliveryRequest> randomDeliveries = deliveries;
-        //randomize deliveries order
-        random_shuffle(randomDeliveries.begin(), randomDeliveries.end());
-
-        // Get energy of solutions
-        double currentDistance = totalDist(depot, deliveries);
-        double newDistance = totalDist(depot, randomDeliveries);
-
-        //generate random double uniformly distributed between 0 and 1
-        random_device rd;
-        mt19937 e2(rd());
-        uniform_real_distribution<> dist(0, 1);
-        double rand = dist(e2);
-
-        //calculate acceptance probabilty based on annealing method
-        double acceptanceProbability = 0.0;
-        //if the new solution is better than the current one, guarantee acceptance since 2.0 is certainly > (0-1)
-        if (newDistance < currentDistance)
-            acceptanceProbability = 2.0; 
-        // If the new solution is worse, calculate an acceptance probability
-        else
-            acceptanceProbability = exp((currentDistance - newDistance) / temp);
+    //crow distances are always reported; road distances, when asked for and
+    //available for every stop, are what gets minimized
+    chrono::steady_clock::time_point started = chrono::steady_clock::now();
+    PlannerStats work;
+    oldCrowDistance = crowLength(depot, deliveries);
 
-        // Decide if we should accept the new path using annealing method
-        if (acceptanceProbability > rand)
-            deliveries = randomDeliveries;
-
-        // Keep track of the best solution found
-        if (totalDist(depot, deliveries) < totalDist(depot, best)) {
-            best = deliveries;
-        }
+    if (m_clusterStops > 0 && static_cast<int>(deliveries.size()) > m_clusterStops)
+        solveInClusters(depot, deliveries, work);
+    else
+    {
+        //work on a tour of stop numbers, depot first, rather than on copies of the deliveries
+        DistanceMatrix matrix;
+        distances(depot, deliveries, m_metric == ROAD_DISTANCE && streets != nullptr, matrix, work);
+        vector<int> tour;
+        for (int i = 0; i <= static_cast<int>(deliveries.size()); i++)
+            tour.push_back(i);
+        solve(tour, matrix, threadLimit(), work);
 
-        // Cool system
-        temp *= 1 - coolingRate;
+        //set deliveries to the best solution found
+        vector<DeliveryRequest> reordered;
+        for (size_t i = 1; i < tour.size(); i++)
+            reordered.push_back(deliveries[tour[i] - 1]);
+        deliveries = reordered;
     }
 
-    newCrowDistance = totalDist(depot, best);
-    //set deliveries to the best solution found
-    deliveries = best;
+    newCrowDistance = crowLength(depot, deliveries);
+    if (m_stats != nullptr)
+    {
+        work.optimizeSeconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+        *m_stats += work;
+    }
 }
 
 
@@ -141,3 +950,43 @@ void DeliveryOptimizer::optimizeDeliveryOrder(
 {
     return m_impl->optimizeDeliveryOrder(depot, deliveries, oldCrowDistance, newCrowDistance);
 }
+
+void DeliveryOptimizer::setDistanceMetric(DistanceMetric metric)
+{
+    m_impl->setDistanceMetric(metric);
+}
+
+void DeliveryOptimizer::setAnnealing(bool anneal)
+{
+    m_impl->setAnnealing(anneal);
+}
+
+void DeliveryOptimizer::setAnnealingChains(int chains)
+{
+    m_impl->setAnnealingChains(chains);
+}
+
+void DeliveryOptimizer::setSeed(uint64_t seed)
+{
+    m_impl->setSeed(seed);
+}
+
+void DeliveryOptimizer::setExactThreshold(int stops)
+{
+    m_impl->setExactThreshold(stops);
+}
+
+void DeliveryOptimizer::setClusterSize(int stops)
+{
+    m_impl->setClusterSize(stops);
+}
+
+void DeliveryOptimizer::setThreadLimit(int threads)
+{
+    m_impl->setThreadLimit(threads);
+}
+
+void DeliveryOptimizer::setStats(PlannerStats* stats)
+{
+    m_impl->setStats(stats);
+}
@@ -1,5 +1,11 @@
 #include "provided.h"
+#include "StreetGraph.h"
 #include <vector>
+#include <cstring>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
 using namespace std;
 
 class DeliveryPlannerImpl
@@ -12,15 +18,27 @@ public:
         const vector<DeliveryRequest>& deliveries,
         vector<DeliveryCommand>& commands,
         double& totalDistanceTravelled) const;
+    DeliveryResult streamDeliveryPlan(
+        const GeoCoord& depot,
+        const vector<DeliveryRequest>& deliveries,
+        const DeliverySink& sink,
+        double& totalDistanceTravelled) const;
+    void planBatch(const vector<DeliveryJob>& jobs, vector<DeliveryPlan>& plans, int threads) const;
+    void setStats(PlannerStats* stats);
+    void setThreadLimit(int threads);
 private:
     const StreetMap* streets;
     PointToPointRouter router;
     DeliveryOptimizer optimizer;
-    string getDirection(double angle) const;
-    void generateCommands(list<StreetSegment> segmentList, vector<DeliveryCommand>& commands) const;
+    int m_threads;
+    PlannerStats* m_stats;
+    const char* getDirection(double angle) const;
+    double angleOf(const RouteStep& step) const;
+    bool sameStreet(const RouteStep& a, const RouteStep& b) const;
+    void generateCommands(const vector<RouteStep>& path, const DeliverySink& sink) const;
 };
 
-string DeliveryPlannerImpl::getDirection(double angle) const
+const char* DeliveryPlannerImpl::getDirection(double angle) const
 {
     while (angle < 0)
         angle += 360;
@@ -44,8 +62,23 @@ string DeliveryPlannerImpl::getDirection(double angle) const
         return "invalid angle";
 }
 
+double DeliveryPlannerImpl::angleOf(const RouteStep& step) const
+{
+    //the step's segment's angle from east, in radians, as angleOfLine and angleBetween2Lines work it out
+    const StreetGraph& graph = streets->graph();
+    return atan2(graph.latitude(step.to) - graph.latitude(step.from), graph.longitude(step.to) - graph.longitude(step.from));
+}
+
+bool DeliveryPlannerImpl::sameStreet(const RouteStep& a, const RouteStep& b) const
+{
+    const StreetGraph& graph = streets->graph();
+    uint32_t nameA = graph.edge(a.edge).nameId;
+    uint32_t nameB = graph.edge(b.edge).nameId;
+    return nameA == nameB || strcmp(graph.nameText(nameA), graph.nameText(nameB)) == 0;
+}
+
 DeliveryPlannerImpl::DeliveryPlannerImpl(const StreetMap* sm)
-    :router(sm), optimizer(sm)
+    :router(sm), optimizer(sm), m_threads(0), m_stats(nullptr)
 {
     streets = sm;
 }
@@ -54,79 +87,76 @@ DeliveryPlannerImpl::~DeliveryPlannerImpl()
 {
 }
 
-void DeliveryPlannerImpl::generateCommands(list<StreetSegment> segmentList, vector<DeliveryCommand>& commands) const
+void DeliveryPlannerImpl::setStats(PlannerStats* stats)
+{
+    //the router and optimizer count their own phases
+    m_stats = stats;
+    router.setStats(stats);
+    optimizer.setStats(stats);
+}
+
+void DeliveryPlannerImpl::setThreadLimit(int threads)
+{
+    //kept for planBatch, which shares it out among its workers
+    m_threads = max(threads, 0);
+    optimizer.setThreadLimit(threads);
+}
+
+void DeliveryPlannerImpl::generateCommands(const vector<RouteStep>& path, const DeliverySink& sink) const
 {
     //this function generates proceed and turn commands, deliver commands should be handled outside of it
 
-    //initialize iterators and tracker variables
-    
-    auto segmentIt = segmentList.begin();
-    StreetSegment startSegment = *segmentIt;
-    StreetSegment prevSegment = *segmentIt;
-    string startSegmentDirection = getDirection(angleOfLine(startSegment));
-    double distanceTracker = distanceEarthMiles((startSegment).start, (startSegment).end);
-    
-    for (segmentIt++;segmentIt != segmentList.end();segmentIt++)
+    //initialize tracker variables; the route is a path, so a step is the last one
+    //exactly when it is at the end of path
+    const StreetGraph& graph = streets->graph();
+    size_t last = path.size() - 1;
+    const RouteStep* startStep = &path[0];
+    double distanceTracker = graph.distanceMiles(startStep->from, startStep->to);
+
+    DeliveryStep command;
+    command.item = nullptr;
+    for (size_t i = 1; i < path.size(); i++)
     {
-        if ((*segmentIt).name == startSegment.name && (*segmentIt).start != segmentList.back().start && (*segmentIt).end != segmentList.back().end)
+        const RouteStep& step = path[i];
+        double length = graph.distanceMiles(step.from, step.to);
+        if (sameStreet(step, *startStep) && i != last)
         {
             //add the distance of the current segment to the running total for this proceed command
-            distanceTracker += distanceEarthMiles((*segmentIt).start, (*segmentIt).end);
-            prevSegment = *segmentIt;
+            distanceTracker += length;
             continue;
         }
-        else
+
+        //if last segment in the route
+        if (i == last)
+            distanceTracker += length;
+        //proceed command for the path traveled along street
+        command.kind = DeliveryStep::PROCEED;
+        command.direction = getDirection(rad2deg(angleOf(*startStep)));
+        command.streetName = graph.nameText(graph.edge(startStep->edge).nameId);
+        command.distance = distanceTracker;
+        sink(command);
+        //if last segment, dont make a turn command
+        if (i != last)
         {
-            //if last segment in the segment list
-            if ((*segmentIt).start == segmentList.back().start && (*segmentIt).end == segmentList.back().end)
-                distanceTracker += distanceEarthMiles((*segmentIt).start, (*segmentIt).end);
-            //proceed command for the path traveled along street
-            DeliveryCommand proceed = DeliveryCommand();
-            proceed.initAsProceedCommand(startSegmentDirection, startSegment.name, distanceTracker);
-            commands.push_back(proceed);
-            //if last segment, dont make a turn command
-            if ((*segmentIt).start != segmentList.back().start && (*segmentIt).end != segmentList.back().end)
+            //turn or proceed command for next street; angleBetween2Lines for the two steps
+            double turnAngle = rad2deg(angleOf(step) - angleOf(path[i - 1]));
+            if (turnAngle < 0)
+                turnAngle += 360;
+            if (turnAngle >= 1 && turnAngle <= 359)
             {
-                //turn or proceed command for next street
-                auto turnAngle = angleBetween2Lines(prevSegment, *segmentIt);
-                if (turnAngle < 1 || turnAngle > 359)
-                {
-                    //begin generation of next proceed command
-                    startSegment = *segmentIt;
-                    distanceTracker = distanceEarthMiles((startSegment).start, (startSegment).end);
-                    startSegmentDirection = getDirection(angleOfLine(startSegment));
-                    prevSegment = *segmentIt;
-                    continue;
-                }
-                else if (turnAngle >= 1 && turnAngle < 180)
-                {
-                    //turn left
-                    DeliveryCommand turn = DeliveryCommand();
-                    turn.initAsTurnCommand("left", (*segmentIt).name);
-                    commands.push_back(turn);
-                }
-                else if (turnAngle >= 180 && turnAngle <= 359)
-                {
-                    //turn right
-                    DeliveryCommand turn = DeliveryCommand();
-                    turn.initAsTurnCommand("right", (*segmentIt).name);
-                    commands.push_back(turn);
-                }
+                //turn left or right
+                command.kind = DeliveryStep::TURN;
+                command.direction = turnAngle < 180 ? "left" : "right";
+                command.streetName = graph.nameText(graph.edge(step.edge).nameId);
+                command.distance = 0;
+                sink(command);
             }
-            
-
-            //set start segment, start seg direction, distance tracker
-            startSegment = *segmentIt;
-            distanceTracker = distanceEarthMiles((startSegment).start, (startSegment).end);
-            startSegmentDirection = getDirection(angleOfLine(startSegment));
         }
 
-        //update previous segment
-        prevSegment = *segmentIt;
+        //begin generation of next proceed command
+        startStep = &step;
+        distanceTracker = length;
     }
-
-    
-
 }
 
 DeliveryResult DeliveryPlannerImpl::generateDeliveryPlan(
@@ -134,14 +164,38 @@ DeliveryResult DeliveryPlannerImpl::generateDeliveryPlan(
     const vector<DeliveryRequest>& deliveries,
     vector<DeliveryCommand>& commands,
     double& totalDistanceTravelled) const
+{
+    //clear commands vector in case it contains junk
+    commands.clear();
+
+    //collect the streamed steps as DeliveryCommands
+    return streamDeliveryPlan(depot, deliveries, [&commands](const DeliveryStep& step) {
+        commands.push_back(DeliveryCommand());
+        switch (step.kind)
+        {
+          case DeliveryStep::PROCEED:
+            commands.back().initAsProceedCommand(step.direction, step.streetName, step.distance);
+            break;
+          case DeliveryStep::TURN:
+            commands.back().initAsTurnCommand(step.direction, step.streetName);
+            break;
+          case DeliveryStep::DELIVER:
+            commands.back().initAsDeliverCommand(step.item);
+            break;
+        }
+    }, totalDistanceTravelled);
+}
+
+DeliveryResult DeliveryPlannerImpl::streamDeliveryPlan(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    const DeliverySink& sink,
+    double& totalDistanceTravelled) const
 {
     //cannot operate on empty deliveries
     if (deliveries.empty())
         return BAD_COORD;
 
-    //clear commands vector in case it contains junk
-    commands.clear();
-    
     totalDistanceTravelled = 0.0;
     double tempDistanceTracker = 0.0;
 
@@ -151,56 +205,92 @@ DeliveryResult DeliveryPlannerImpl::generateDeliveryPlan(
     //potentially reorder deliveries using optimizer
     auto orderedDeliveries = deliveries;
     optimizer.optimizeDeliveryOrder(depot, orderedDeliveries, oldcrowdistance, newcrowdistance);
-    //create a list to temporarily hold streetsegments from router
-    //list contents are cleared when processed by generatePointToPointRoute
-    list<StreetSegment> segmentList;
-
-    //for each delivery
-    auto it = orderedDeliveries.begin();
-    auto itPrev = orderedDeliveries.end();
-    for (; it != orderedDeliveries.end(); it++)
+    //one path, reused for every leg; generatePointToPointPath clears it
+    vector<RouteStep> path;
+
+    //with stats wanted, count the steps on their way to the sink
+    uint64_t steps = 0;
+    DeliverySink counting;
+    if (m_stats != nullptr)
+        counting = [&steps, &sink](const DeliveryStep& step) { steps++; sink(step); };
+    const DeliverySink& out = m_stats != nullptr ? counting : sink;
+    chrono::steady_clock::time_point started;
+
+    //for each delivery, route there from the depot or the previous delivery,
+    //then come back to the depot from the last one
+    DeliveryStep deliver;
+    deliver.kind = DeliveryStep::DELIVER;
+    deliver.direction = deliver.streetName = nullptr;
+    deliver.distance = 0;
+    for (size_t i = 0; i <= orderedDeliveries.size(); i++)
     {
-        if (it == orderedDeliveries.begin())
-        {
-            //for the first route, start from the depot and route to the first delivery location
-            if (router.generatePointToPointRoute(depot, (*it).location, segmentList, tempDistanceTracker) != DELIVERY_SUCCESS)
-                return router.generatePointToPointRoute(depot, (*it).location, segmentList, tempDistanceTracker);
-            totalDistanceTravelled += tempDistanceTracker;
-        }
-        else
+        const GeoCoord& from = i == 0 ? depot : orderedDeliveries[i - 1].location;
+        const GeoCoord& to = i == orderedDeliveries.size() ? depot : orderedDeliveries[i].location;
+        DeliveryResult result = router.generatePointToPointPath(from, to, path, tempDistanceTracker);
+        if (result != DELIVERY_SUCCESS)
+            return result;
+        totalDistanceTravelled += tempDistanceTracker;
+        if (m_stats != nullptr)
+            started = chrono::steady_clock::now();
+
+        //if the path is not empty, generate commands for the route that was generated
+        if (!path.empty())
+            generateCommands(path, out);
+
+        //then a deliver command, unless this was the way back to the depot
+        if (i < orderedDeliveries.size())
         {
-            //find route from previous delivery location to next one
-            if (router.generatePointToPointRoute((*itPrev).location, (*it).location, segmentList, tempDistanceTracker) != DELIVERY_SUCCESS)
-                return router.generatePointToPointRoute((*itPrev).location, (*it).location, segmentList, tempDistanceTracker);
-            totalDistanceTravelled += tempDistanceTracker;
+            deliver.item = orderedDeliveries[i].item.c_str();
+            out(deliver);
         }
-        
-        //if the segment list is not empty, generate commands for the route that was generated
-        if (!segmentList.empty())
-            generateCommands(segmentList, commands);
-
-        //finally, generate a deliver command
-        DeliveryCommand deliver = DeliveryCommand();
-        deliver.initAsDeliverCommand((*it).item);
-        commands.push_back(deliver);
-
-        //update the previous iterator
-        itPrev = it;
+        if (m_stats != nullptr)
+            m_stats->commandSeconds += chrono::duration<double>(chrono::steady_clock::now() - started).count();
     }
+    if (m_stats != nullptr)
+        m_stats->commands += steps;
 
-    //iterate back to the final delivery location
-    it--; 
-    //route back to depot once finished with deliveries
-    if (router.generatePointToPointRoute((*it).location, depot, segmentList, tempDistanceTracker) != DELIVERY_SUCCESS)
-        return router.generatePointToPointRoute((*it).location, depot, segmentList, tempDistanceTracker);
-    totalDistanceTravelled += tempDistanceTracker;
+    return DELIVERY_SUCCESS;
+}
 
-    //convert sgementList into proceed or turn commands
-    if (!segmentList.empty())
-        generateCommands(segmentList, commands);
+// Workers take the next unplanned job until none are left, each with a planner of
+// its own (so its own router and optimizer); the map is only ever read.  Every
+// plan goes to its job's slot, so the result doesn't depend on which worker took it.
+void DeliveryPlannerImpl::planBatch(const vector<DeliveryJob>& jobs, vector<DeliveryPlan>& plans, int threads) const
+{
+    plans.assign(jobs.size(), DeliveryPlan());
+    if (threads <= 0)
+        threads = max(1, static_cast<int>(thread::hardware_concurrency()));
+    threads = static_cast<int>(min<size_t>(threads, jobs.size()));
 
-    
-    return DELIVERY_SUCCESS;
+    //every worker plans as this planner would, with an equal share of its thread
+    //limit, counting into stats of its own that are added to this planner's at the end
+    int limit = m_threads > 0 ? m_threads : max(1, static_cast<int>(thread::hardware_concurrency()));
+    int workerThreads = max(1, limit / max(threads, 1));
+    vector<PlannerStats> counted(threads);
+    atomic<size_t> nextJob(0);
+    auto work = [&](int worker) {
+        DeliveryPlannerImpl planner(streets);
+        planner.setThreadLimit(workerThreads);
+        if (m_stats != nullptr)
+            planner.setStats(&counted[worker]);
+        for (size_t job = nextJob++; job < jobs.size(); job = nextJob++)
+        {
+            DeliveryPlan& plan = plans[job];
+            plan.result = planner.generateDeliveryPlan(jobs[job].depot, jobs[job].deliveries,
+                                                       plan.commands, plan.totalDistanceTravelled);
+        }
+    };
+
+    vector<thread> workers;
+    for (int i = 1; i < threads; i++)
+        workers.push_back(thread(work, i));
+    if (threads > 0)
+        work(0);
+    for (thread& worker : workers)
+        worker.join();
+    if (m_stats != nullptr)
+        for (const PlannerStats& stats : counted)
+            *m_stats += stats;
 }
 
 //******************** DeliveryPlanner functions ******************************
@@ -226,3 +316,27 @@ DeliveryResult DeliveryPlanner::generateDeliveryPlan(
 {
     return m_impl->generateDeliveryPlan(depot, deliveries, commands, totalDistanceTravelled);
 }
+
+DeliveryResult DeliveryPlanner::streamDeliveryPlan(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    const DeliverySink& sink,
+    double& totalDistanceTravelled) const
+{
+    return m_impl->streamDeliveryPlan(depot, deliveries, sink, totalDistanceTravelled);
+}
+
+void DeliveryPlanner::planBatch(const vector<DeliveryJob>& jobs, vector<DeliveryPlan>& plans, int threads) const
+{
+    m_impl->planBatch(jobs, plans, threads);
+}
+
+void DeliveryPlanner::setThreadLimit(int threads)
+{
+    m_impl->setThreadLimit(threads);
+}
+
+void DeliveryPlanner::setStats(PlannerStats* stats)
+{
+    m_impl->setStats(stats);
+}
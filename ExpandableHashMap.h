@@ -88,19 +88,21 @@ int ExpandableHashMap<KeyType, ValueType>::size() const
 template<typename KeyType, typename ValueType>
 void ExpandableHashMap<KeyType, ValueType>::associate(const KeyType& key, const ValueType& value)
 {
-	//set curr to the list at the bucket of interest
-	auto curr = m_map[getBucketNumber(key)];
+	//the list at the bucket of interest
+	std::list<Node>& bucket = m_map[getBucketNumber(key)];
 
 	//if the key already exists at the bucket, update its value and return
-	ValueType* pointer = find(key);
-	if (pointer != nullptr)
+	for (auto it = bucket.begin(); it != bucket.end(); it++)
 	{
-		(*pointer) = value;
-		return;
+		if ((*it).m_key == key)
+		{
+			(*it).m_value = value;
+			return;
+		}
 	}
 
 	//add the association
-	m_map[getBucketNumber(key)].push_back(Node(key, value));
+	bucket.push_back(Node(key, value));
 	m_associations++;
 
 	
@@ -118,17 +120,15 @@ void ExpandableHashMap<KeyType, ValueType>::associate(const KeyType& key, const
 		newMap.swap(m_map);
 
 		//loop through the old map
-		for (int i = 0; i < newMap.size(); i++)
+		for (std::size_t i = 0; i < newMap.size(); i++)
 		{
 
-			//set it to the first item of the list
-			auto it = newMap[i].begin();
-
-			//loop through list
-			for (;it != newMap[i].end(); it++)
+			//move each node to the appropriate bucket in the new map
+			//splicing relinks the node rather than copying its key and value
+			while (!newMap[i].empty())
 			{
-				//add each node's key and value to the appropriate node in the new map
-				m_map[getBucketNumber((*it).m_key)].push_back(Node((*it).m_key, (*it).m_value));
+				std::list<Node>& target = m_map[getBucketNumber(newMap[i].front().m_key)];
+				target.splice(target.end(), newMap[i], newMap[i].begin());
 			}
 		}
 
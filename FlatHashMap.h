@@ -0,0 +1,312 @@
+#ifndef FLATHASHMAP
+#define FLATHASHMAP
+
+#include <new>
+#include <utility>
+
+//flat (open addressing) variant of ExpandableHashMap
+//
+//entries live in one array and collisions are resolved by Robin Hood linear probing,
+//so a lookup touches a couple of neighboring slots instead of walking a list of heap
+//nodes.  It takes the same template arguments and uses the same global
+//hasher(const KeyType&) function as ExpandableHashMap, and adds reserve, try_emplace,
+//move-only values and iteration.  Pointers to values stay valid until the next insertion.
+
+template <typename KeyType, typename ValueType>
+class FlatHashMap
+{
+public:
+	struct Entry
+	{
+		KeyType key;		//don't modify a key in place
+		ValueType value;
+	};
+
+	FlatHashMap(double maximumLoadFactor = 0.5);
+	~FlatHashMap();
+	void reset();
+	int size() const;
+	void associate(const KeyType& key, const ValueType& value);
+
+	//make room for n associations without rehashing
+	void reserve(int n);
+
+	//if key is absent, construct its value from args; either way return a pointer to
+	//key's value and whether it was inserted
+	template <typename... Args>
+	std::pair<ValueType*, bool> try_emplace(const KeyType& key, Args&&... args);
+
+	//remove key's association, if any; returns whether there was one
+	bool erase(const KeyType& key);
+
+	// for a map that can't be modified, return a pointer to const ValueType
+	const ValueType* find(const KeyType& key) const;
+
+	// for a modifiable map, return a pointer to modifiable ValueType
+	ValueType* find(const KeyType& key)
+	{
+		return const_cast<ValueType*>(const_cast<const FlatHashMap*>(this)->find(key));
+	}
+
+	//iteration over every association, in no particular order
+	template <typename MapType, typename EntryType>
+	class Iterator
+	{
+	public:
+		Iterator(MapType* map, unsigned int slot)
+			:m_owner(map), m_slot(slot)
+		{
+			skipEmpty();
+		}
+		EntryType& operator*() const { return m_owner->m_entries[m_slot]; }
+		EntryType* operator->() const { return &m_owner->m_entries[m_slot]; }
+		Iterator& operator++() { m_slot++; skipEmpty(); return *this; }
+		bool operator==(const Iterator& other) const { return m_slot == other.m_slot; }
+		bool operator!=(const Iterator& other) const { return m_slot != other.m_slot; }
+	private:
+		MapType* m_owner;
+		unsigned int m_slot;
+		void skipEmpty()
+		{
+			while (m_slot < m_owner->m_capacity && m_owner->m_distance[m_slot] == 0)
+				m_slot++;
+		}
+	};
+	typedef Iterator<FlatHashMap, Entry> iterator;
+	typedef Iterator<const FlatHashMap, const Entry> const_iterator;
+
+	iterator begin() { return iterator(this, 0); }
+	iterator end() { return iterator(this, m_capacity); }
+	const_iterator begin() const { return const_iterator(this, 0); }
+	const_iterator end() const { return const_iterator(this, m_capacity); }
+
+	// C++11 syntax for preventing copying and assignment
+	FlatHashMap(const FlatHashMap&) = delete;
+	FlatHashMap& operator=(const FlatHashMap&) = delete;
+
+private:
+	double m_loadFactor;
+	int m_associations;
+	unsigned int m_capacity;	//always a power of two
+	unsigned int m_shift;		//32 - log2(m_capacity)
+	//per slot: 0 if empty, otherwise 1 + the entry's distance from its home slot
+	unsigned int* m_distance;
+	Entry* m_entries;			//raw storage, constructed only where m_distance != 0
+
+	unsigned int homeSlot(const KeyType& key) const
+	{
+		unsigned int hasher(const KeyType & k);  // prototype
+		//Fibonacci hashing spreads weak hashes (like small integers) over the table
+		return (hasher(key) * 2654435769u) >> m_shift;
+	}
+	void allocate(unsigned int capacity);
+	void release();
+	void grow();
+	void insertEntry(Entry& entry, Entry** placed);
+	unsigned int findSlot(const KeyType& key) const;
+};
+
+template<typename KeyType, typename ValueType>
+FlatHashMap<KeyType, ValueType>::FlatHashMap(double maximumLoadFactor)
+	:m_associations(0), m_distance(nullptr), m_entries(nullptr)
+{
+	//if the load factor is out of range, set it to the default 0.5
+	if (maximumLoadFactor <= 0 || maximumLoadFactor > 0.9)
+		m_loadFactor = 0.5;
+	//otherwise, set it to the inputted one
+	else
+		m_loadFactor = maximumLoadFactor;
+	allocate(8);
+}
+
+template<typename KeyType, typename ValueType>
+FlatHashMap<KeyType, ValueType>::~FlatHashMap()
+{
+	release();
+}
+
+template<typename KeyType, typename ValueType>
+void FlatHashMap<KeyType, ValueType>::allocate(unsigned int capacity)
+{
+	m_capacity = capacity;
+	m_shift = 32;
+	for (unsigned int c = capacity; c > 1; c /= 2)
+		m_shift--;
+	m_distance = new unsigned int[capacity]();
+	m_entries = static_cast<Entry*>(::operator new(sizeof(Entry) * capacity));
+	m_associations = 0;
+}
+
+template<typename KeyType, typename ValueType>
+void FlatHashMap<KeyType, ValueType>::release()
+{
+	//destroy the live entries, then free the storage
+	for (unsigned int i = 0; i < m_capacity; i++)
+		if (m_distance[i] != 0)
+			m_entries[i].~Entry();
+	delete[] m_distance;
+	::operator delete(m_entries);
+	m_distance = nullptr;
+	m_entries = nullptr;
+}
+
+template<typename KeyType, typename ValueType>
+void FlatHashMap<KeyType, ValueType>::reset()
+{
+	//free everything and go back to 8 slots
+	release();
+	allocate(8);
+}
+
+template<typename KeyType, typename ValueType>
+int FlatHashMap<KeyType, ValueType>::size() const
+{
+	return m_associations;
+}
+
+template<typename KeyType, typename ValueType>
+void FlatHashMap<KeyType, ValueType>::reserve(int n)
+{
+	unsigned int capacity = m_capacity;
+	while (n > m_loadFactor * capacity)
+		capacity *= 2;
+	if (capacity == m_capacity)
+		return;
+
+	//move every entry into a table of the new size
+	unsigned int* oldDistance = m_distance;
+	Entry* oldEntries = m_entries;
+	unsigned int oldCapacity = m_capacity;
+	allocate(capacity);
+	for (unsigned int i = 0; i < oldCapacity; i++)
+	{
+		if (oldDistance[i] != 0)
+		{
+			insertEntry(oldEntries[i], nullptr);
+			oldEntries[i].~Entry();
+		}
+	}
+	delete[] oldDistance;
+	::operator delete(oldEntries);
+}
+
+template<typename KeyType, typename ValueType>
+void FlatHashMap<KeyType, ValueType>::grow()
+{
+	//one more association than fits doubles the table
+	reserve(static_cast<int>(m_loadFactor * m_capacity) + 1);
+}
+
+//Robin Hood insertion of an entry known to be absent: walk from the home slot and
+//whenever the resident entry is closer to its own home than the one being placed,
+//swap them and carry on placing the displaced entry.  The entry is moved from.
+//placed, if not null, receives the slot the original entry ended up in.
+template<typename KeyType, typename ValueType>
+void FlatHashMap<KeyType, ValueType>::insertEntry(Entry& entry, Entry** placed)
+{
+	unsigned int slot = homeSlot(entry.key);
+	unsigned int distance = 1;
+	Entry carried(std::move(entry));
+	bool carryingOriginal = true;
+	for (;; slot = (slot + 1) & (m_capacity - 1), distance++)
+	{
+		if (m_distance[slot] == 0)
+		{
+			::new (static_cast<void*>(&m_entries[slot])) Entry(std::move(carried));
+			m_distance[slot] = distance;
+			if (carryingOriginal && placed != nullptr)
+				*placed = &m_entries[slot];
+			m_associations++;
+			return;
+		}
+		if (m_distance[slot] < distance)
+		{
+			std::swap(carried, m_entries[slot]);
+			std::swap(distance, m_distance[slot]);
+			if (carryingOriginal && placed != nullptr)
+				*placed = &m_entries[slot];
+			carryingOriginal = false;
+		}
+	}
+}
+
+template<typename KeyType, typename ValueType>
+template<typename... Args>
+std::pair<ValueType*, bool> FlatHashMap<KeyType, ValueType>::try_emplace(const KeyType& key, Args&&... args)
+{
+	//if the key already exists, leave its value alone
+	ValueType* existing = find(key);
+	if (existing != nullptr)
+		return std::make_pair(existing, false);
+
+	//grow first, so the slot handed back stays put
+	if (m_associations + 1 > m_loadFactor * m_capacity)
+		grow();
+	Entry entry{ key, ValueType(std::forward<Args>(args)...) };
+	Entry* placed = nullptr;
+	insertEntry(entry, &placed);
+	return std::make_pair(&placed->value, true);
+}
+
+template<typename KeyType, typename ValueType>
+void FlatHashMap<KeyType, ValueType>::associate(const KeyType& key, const ValueType& value)
+{
+	//update the value in place if the key already exists, otherwise add it
+	std::pair<ValueType*, bool> result = try_emplace(key, value);
+	if (!result.second)
+		*result.first = value;
+}
+
+//the slot holding key, or m_capacity if it isn't in the map
+template<typename KeyType, typename ValueType>
+unsigned int FlatHashMap<KeyType, ValueType>::findSlot(const KeyType& key) const
+{
+	if (m_associations == 0)
+		return m_capacity;
+
+	//an entry can't be further from home than the resident of any slot on its way,
+	//so stop at the first slot whose entry is closer to its home than we are
+	unsigned int slot = homeSlot(key);
+	for (unsigned int distance = 1; m_distance[slot] >= distance; distance++, slot = (slot + 1) & (m_capacity - 1))
+	{
+		if (m_entries[slot].key == key)
+			return slot;
+	}
+	return m_capacity;
+}
+
+template<typename KeyType, typename ValueType>
+const ValueType* FlatHashMap<KeyType, ValueType>::find(const KeyType& key) const
+{
+	unsigned int slot = findSlot(key);
+	//if no association found, return nullptr
+	if (slot == m_capacity)
+		return nullptr;
+	return &m_entries[slot].value;
+}
+
+template<typename KeyType, typename ValueType>
+bool FlatHashMap<KeyType, ValueType>::erase(const KeyType& key)
+{
+	unsigned int slot = findSlot(key);
+	if (slot == m_capacity)
+		return false;
+
+	//shift the following entries of the run back one slot each, so no tombstone
+	//is needed and every entry stays as close to home as before
+	m_entries[slot].~Entry();
+	unsigned int next = (slot + 1) & (m_capacity - 1);
+	while (m_distance[next] > 1)
+	{
+		::new (static_cast<void*>(&m_entries[slot])) Entry(std::move(m_entries[next]));
+		m_entries[next].~Entry();
+		m_distance[slot] = m_distance[next] - 1;
+		slot = next;
+		next = (next + 1) & (m_capacity - 1);
+	}
+	m_distance[slot] = 0;
+	m_associations--;
+	return true;
+}
+
+#endif
@@ -0,0 +1,50 @@
+#include "LandmarkIndex.h"
+
+#include <algorithm>
+using namespace std;
+
+LandmarkIndex::LandmarkIndex()
+    :m_count(0)
+{
+}
+
+void LandmarkIndex::clear()
+{
+    m_count = 0;
+    vector<uint32_t>().swap(m_landmarks);
+    vector<double>().swap(m_distances);
+}
+
+void LandmarkIndex::build(const StreetGraph& graph, int count)
+{
+    clear();
+    vector<uint32_t> candidates = graph.largestComponent();
+    if (candidates.empty() || count <= 0)
+        return;
+    count = min<int>(count, static_cast<int>(candidates.size()));
+
+    //start from the node farthest from an arbitrary one, then keep adding the node
+    //farthest from every landmark so far.  Each landmark's distances go straight
+    //into the table, node by node, so only one search's worth is held besides it
+    vector<double> distance;
+    graph.distancesFrom(candidates[0], distance);
+    vector<double> nearest(graph.nodeCount(), INFINITY);
+    m_distances.resize(size_t(graph.nodeCount()) * count);
+    uint32_t next = candidates[0];
+    for (uint32_t node : candidates)
+        if (distance[node] > distance[next])
+            next = node;
+    for (int k = 0; k < count; k++)
+    {
+        m_landmarks.push_back(next);
+        graph.distancesFrom(next, distance);
+        for (uint32_t node = 0; node < graph.nodeCount(); node++)
+            m_distances[size_t(node) * count + k] = distance[node];
+        for (uint32_t node : candidates)
+            nearest[node] = min(nearest[node], distance[node]);
+        for (uint32_t node : candidates)
+            if (nearest[node] > nearest[next])
+                next = node;
+    }
+    m_count = count;
+}
@@ -0,0 +1,59 @@
+#ifndef LANDMARKINDEX_INCLUDED
+#define LANDMARKINDEX_INCLUDED
+
+#include "StreetGraph.h"
+
+#include <cstdint>
+#include <cmath>
+#include <vector>
+
+// Landmark (ALT) lower bounds on road distance.
+//
+// A handful of landmarks are picked far apart and far out on the map, and the road
+// distance from every landmark to every node is stored.  By the triangle inequality
+// |d(L,a) - d(L,b)| <= d(a,b) for any landmark L, so the largest of those differences
+// is a lower bound on the road distance from a to b.  Behind a river or a freeway,
+// where the crow flies distance is far too optimistic, it is usually much tighter.
+//
+// Landmarks are chosen by farthest point selection inside the largest connected part
+// of the map; nodes outside it are unreachable from every landmark and get no bound.
+class LandmarkIndex
+{
+public:
+    static const int DEFAULT_LANDMARKS = 16;
+
+    LandmarkIndex();
+
+    bool empty() const { return m_count == 0; }
+    int count() const { return m_count; }
+    uint32_t landmark(int k) const { return m_landmarks[k]; }
+
+    // landmark distances are stored node by node, so one bound reads two short rows
+    double lowerBound(uint32_t a, uint32_t b) const
+    {
+        const double* da = &m_distances[size_t(a) * m_count];
+        const double* db = &m_distances[size_t(b) * m_count];
+        double bound = 0;
+        for (int k = 0; k < m_count; k++)
+        {
+            //a landmark that reaches neither node says nothing about them
+            if (da[k] == INFINITY && db[k] == INFINITY)
+                continue;
+            double difference = std::fabs(da[k] - db[k]);
+            if (difference > bound)
+                bound = difference;
+        }
+        return bound;
+    }
+
+    // pick count landmarks in graph and run a Dijkstra from each; replaces the current index
+    void build(const StreetGraph& graph, int count = DEFAULT_LANDMARKS);
+    void clear();
+
+private:
+    int m_count;
+    std::vector<uint32_t> m_landmarks;
+    std::vector<double> m_distances;    // m_distances[node * m_count + k]
+};
+
+#endif // LANDMARKINDEX_INCLUDED
@@ -0,0 +1,333 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cmath>
+using namespace std;
+
+// Writes a synthetic street map in the format StreetMap::load reads (a street name
+// line, a segment count line, then one "lat lon lat lon" line per segment) and a
+// matching deliveries file (the depot, then "lat lon:item" lines).
+//
+// The main region is a rows x cols lattice of intersections a block apart.  A grid
+// layout keeps it square; an organic layout moves every intersection by up to a
+// third of a block, leaves out some blocks and adds some diagonal streets.  Streets
+// follow rows, columns or diagonals for a random number of blocks, each taking a
+// name from a shared pool, so names repeat across the map the way "Main Street"
+// does across a county.  Islands are small grids off to the side, joined to
+// nothing.  The depot and deliveries are intersections of the largest connected
+// part of the map, so every delivery can be reached.
+//
+// usage: MapGenerator [--layout grid|organic] [--rows N] [--cols N] [--islands N]
+//                     [--names N] [--deliveries N] [--seed S]
+//                     [--map FILE] [--deliveries-file FILE]
+
+namespace
+{
+    //a block is about 110 m north-south
+    const double BLOCK_DEGREES = 0.001;
+    const double ORIGIN_LAT = 34.0;
+    const double ORIGIN_LON = -118.5;
+
+    //organic layouts leave out this share of blocks, and add a diagonal in this share of squares
+    const double MISSING_BLOCKS = 0.12;
+    const double DIAGONALS = 0.04;
+
+    //streets run this many blocks before the next one starts
+    const int MIN_STREET_BLOCKS = 3;
+    const int MAX_STREET_BLOCKS = 40;
+
+    //islands are grids of this many intersections a side
+    const int ISLAND_SIDE = 12;
+
+    const char* NAME_BASES[] = {
+        "Oak", "Maple", "Pine", "Cedar", "Elm", "Willow", "Sunset", "Lincoln", "Washington",
+        "Park", "Lake", "Hill", "Valley", "Ocean", "Mission", "Highland", "Center", "Church",
+        "Spring", "Meadow", "River", "Forest", "Cherry", "Walnut", "Sycamore", "Madison",
+        "Jefferson", "Franklin", "Grand", "Broadway", "Wilshire", "Olympic", "Pico", "Venice"
+    };
+    const char* NAME_SUFFIXES[] = {
+        "Street", "Avenue", "Boulevard", "Drive", "Lane", "Road", "Way", "Place", "Court", "Terrace"
+    };
+
+    struct Options
+    {
+        bool organic = false;
+        int rows = 100;
+        int cols = 100;
+        int islands = 3;
+        int names = 500;
+        int deliveries = 1000;
+        uint64_t seed = 1;
+        string mapFile = "generated_map.txt";
+        string deliveriesFile = "generated_deliveries.txt";
+    };
+
+    struct Street
+    {
+        int name;
+        vector<pair<uint32_t, uint32_t>> segments;
+    };
+
+    class MapBuilder
+    {
+    public:
+        MapBuilder(const Options& options)
+            :m_options(options), m_random(options.seed)
+        {
+        }
+
+        void build();
+        bool writeMap() const;
+        bool writeDeliveries();
+        size_t segmentCount() const;
+
+    private:
+        const Options& m_options;
+        mt19937_64 m_random;
+        vector<double> m_lat;
+        vector<double> m_lon;
+        vector<Street> m_streets;
+        vector<string> m_names;
+        vector<uint32_t> m_parent;   //union-find over intersections
+
+        double uniform() { return (m_random() >> 11) * (1.0 / 9007199254740992.0); }
+        int pick(int low, int high) { return low + static_cast<int>(m_random() % uint64_t(high - low + 1)); }
+
+        uint32_t addLattice(int rows, int cols, double lat0, double lon0, bool organic);
+        void addStreets(const vector<uint32_t>& line, const vector<bool>& present);
+        uint32_t root(uint32_t node);
+    };
+
+    uint32_t MapBuilder::root(uint32_t node)
+    {
+        while (m_parent[node] != node)
+            node = m_parent[node] = m_parent[m_parent[node]];
+        return node;
+    }
+
+    // Cut a line of intersections into streets: present[i] says whether the block
+    // from line[i] to line[i+1] exists, and a missing block always ends a street.
+    void MapBuilder::addStreets(const vector<uint32_t>& line, const vector<bool>& present)
+    {
+        Street street;
+        int blocksLeft = 0;
+        for (size_t i = 0; i + 1 < line.size(); i++)
+        {
+            if (!present[i] || blocksLeft == 0)
+            {
+                if (!street.segments.empty())
+                    m_streets.push_back(street);
+                street.segments.clear();
+                street.name = pick(0, static_cast<int>(m_names.size()) - 1);
+                blocksLeft = pick(MIN_STREET_BLOCKS, MAX_STREET_BLOCKS);
+            }
+            if (!present[i])
+                continue;
+            street.segments.push_back(make_pair(line[i], line[i + 1]));
+            m_parent[root(line[i])] = root(line[i + 1]);
+            blocksLeft--;
+        }
+        if (!street.segments.empty())
+            m_streets.push_back(street);
+    }
+
+    // add a rows x cols lattice with its top left corner at (lat0, lon0); returns its first node
+    uint32_t MapBuilder::addLattice(int rows, int cols, double lat0, double lon0, bool organic)
+    {
+        uint32_t first = static_cast<uint32_t>(m_lat.size());
+        double jitter = organic ? BLOCK_DEGREES / 3 : 0;
+        for (int r = 0; r < rows; r++)
+        {
+            for (int c = 0; c < cols; c++)
+            {
+                m_parent.push_back(static_cast<uint32_t>(m_lat.size()));
+                m_lat.push_back(lat0 - r * BLOCK_DEGREES + (uniform() * 2 - 1) * jitter);
+                m_lon.push_back(lon0 + c * BLOCK_DEGREES + (uniform() * 2 - 1) * jitter);
+            }
+        }
+        auto node = [&](int r, int c) { return first + static_cast<uint32_t>(r * cols + c); };
+        auto blocks = [&](size_t count) {
+            vector<bool> present(count);
+            for (size_t i = 0; i < count; i++)
+                present[i] = !organic || uniform() >= MISSING_BLOCKS;
+            return present;
+        };
+
+        vector<uint32_t> line;
+        for (int r = 0; r < rows; r++)
+        {
+            line.clear();
+            for (int c = 0; c < cols; c++)
+                line.push_back(node(r, c));
+            addStreets(line, blocks(line.size() - 1));
+        }
+        for (int c = 0; c < cols; c++)
+        {
+            line.clear();
+            for (int r = 0; r < rows; r++)
+                line.push_back(node(r, c));
+            addStreets(line, blocks(line.size() - 1));
+        }
+        if (organic)
+        {
+            //short diagonal streets across single squares
+            for (int r = 0; r + 1 < rows; r++)
+            {
+                for (int c = 0; c + 1 < cols; c++)
+                {
+                    if (uniform() >= DIAGONALS)
+                        continue;
+                    line.clear();
+                    line.push_back(node(r, c));
+                    line.push_back(node(r + 1, c + 1));
+                    addStreets(line, vector<bool>(1, true));
+                }
+            }
+        }
+        return first;
+    }
+
+    void MapBuilder::build()
+    {
+        //names are "Base Suffix", or numbered ("12th Street") once the plain ones run out
+        int bases = sizeof(NAME_BASES) / sizeof(NAME_BASES[0]);
+        int suffixes = sizeof(NAME_SUFFIXES) / sizeof(NAME_SUFFIXES[0]);
+        for (int i = 0; i < m_options.names; i++)
+        {
+            string suffix = NAME_SUFFIXES[i % suffixes];
+            if (i < bases * suffixes)
+                m_names.push_back(string(NAME_BASES[i / suffixes]) + " " + suffix);
+            else
+            {
+                int n = i / suffixes - bases + 1;
+                const char* th = (n % 100 >= 11 && n % 100 <= 13) ? "th" :
+                    n % 10 == 1 ? "st" : n % 10 == 2 ? "nd" : n % 10 == 3 ? "rd" : "th";
+                m_names.push_back(to_string(n) + th + " " + suffix);
+            }
+        }
+
+        addLattice(m_options.rows, m_options.cols, ORIGIN_LAT, ORIGIN_LON, m_options.organic);
+        //islands sit in a row beyond the east edge, a few blocks apart
+        for (int i = 0; i < m_options.islands; i++)
+        {
+            double lon = ORIGIN_LON + (m_options.cols + 5 + i * (ISLAND_SIDE + 5)) * BLOCK_DEGREES;
+            addLattice(ISLAND_SIDE, ISLAND_SIDE, ORIGIN_LAT, lon, false);
+        }
+    }
+
+    size_t MapBuilder::segmentCount() const
+    {
+        size_t count = 0;
+        for (const Street& street : m_streets)
+            count += street.segments.size();
+        return count;
+    }
+
+    bool MapBuilder::writeMap() const
+    {
+        FILE* out = fopen(m_options.mapFile.c_str(), "w");
+        if (out == nullptr)
+            return false;
+        for (const Street& street : m_streets)
+        {
+            fprintf(out, "%s\n%zu\n", m_names[street.name].c_str(), street.segments.size());
+            for (const auto& seg : street.segments)
+                fprintf(out, "%.7f %.7f %.7f %.7f\n", m_lat[seg.first], m_lon[seg.first], m_lat[seg.second], m_lon[seg.second]);
+        }
+        return fclose(out) == 0;
+    }
+
+    bool MapBuilder::writeDeliveries()
+    {
+        //intersections of the largest connected part; lone ones (every block left out) don't count
+        vector<uint32_t> size(m_lat.size(), 0);
+        vector<bool> used(m_lat.size(), false);
+        for (const Street& street : m_streets)
+            for (const auto& seg : street.segments)
+                used[seg.first] = used[seg.second] = true;
+        for (uint32_t node = 0; node < m_lat.size(); node++)
+            if (used[node])
+                size[root(node)]++;
+        uint32_t largest = static_cast<uint32_t>(max_element(size.begin(), size.end()) - size.begin());
+        vector<uint32_t> nodes;
+        for (uint32_t node = 0; node < m_lat.size(); node++)
+            if (used[node] && root(node) == largest)
+                nodes.push_back(node);
+        if (nodes.empty())
+            return false;
+
+        FILE* out = fopen(m_options.deliveriesFile.c_str(), "w");
+        if (out == nullptr)
+            return false;
+        uint32_t depot = nodes[m_random() % nodes.size()];
+        fprintf(out, "%.7f %.7f\n", m_lat[depot], m_lon[depot]);
+        for (int i = 0; i < m_options.deliveries; i++)
+        {
+            uint32_t node = nodes[m_random() % nodes.size()];
+            fprintf(out, "%.7f %.7f:Parcel %d\n", m_lat[node], m_lon[node], i + 1);
+        }
+        return fclose(out) == 0;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--layout" && hasValue)
+        {
+            string layout = argv[++i];
+            if (layout != "grid" && layout != "organic")
+            {
+                cerr << "Unknown layout " << layout << endl;
+                return 1;
+            }
+            options.organic = layout == "organic";
+        }
+        else if (arg == "--rows" && hasValue)
+            options.rows = max(2, atoi(argv[++i]));
+        else if (arg == "--cols" && hasValue)
+            options.cols = max(2, atoi(argv[++i]));
+        else if (arg == "--islands" && hasValue)
+            options.islands = max(0, atoi(argv[++i]));
+        else if (arg == "--names" && hasValue)
+            options.names = max(1, atoi(argv[++i]));
+        else if (arg == "--deliveries" && hasValue)
+            options.deliveries = max(0, atoi(argv[++i]));
+        else if (arg == "--seed" && hasValue)
+            options.seed = strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--map" && hasValue)
+            options.mapFile = argv[++i];
+        else if (arg == "--deliveries-file" && hasValue)
+            options.deliveriesFile = argv[++i];
+        else
+        {
+            cerr << "Usage: " << argv[0] << " [--layout grid|organic] [--rows N] [--cols N] [--islands N]\n"
+                 << "       [--names N] [--deliveries N] [--seed S] [--map FILE] [--deliveries-file FILE]" << endl;
+            return 1;
+        }
+    }
+
+    MapBuilder builder(options);
+    builder.build();
+    if (!builder.writeMap())
+    {
+        cerr << "Unable to write map data file " << options.mapFile << endl;
+        return 1;
+    }
+    if (!builder.writeDeliveries())
+    {
+        cerr << "Unable to write delivery request file " << options.deliveriesFile << endl;
+        return 1;
+    }
+    cout << builder.segmentCount() << " segments written to " << options.mapFile << ", "
+         << options.deliveries << " deliveries to " << options.deliveriesFile << endl;
+}
@@ -0,0 +1,104 @@
+#include "MappedFile.h"
+
+#include <cstring>
+#include <fstream>
+#include <utility>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+using namespace std;
+
+MappedFile::MappedFile()
+    :m_data(nullptr), m_size(0), m_mapping(nullptr)
+{
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+void MappedFile::close()
+{
+#ifndef _WIN32
+    if (m_mapping != nullptr)
+        munmap(m_mapping, m_size);
+#endif
+    m_mapping = nullptr;
+    vector<uint64_t>().swap(m_buffer);
+    m_data = nullptr;
+    m_size = 0;
+}
+
+void MappedFile::swap(MappedFile& other)
+{
+    std::swap(m_data, other.m_data);
+    std::swap(m_size, other.m_size);
+    std::swap(m_mapping, other.m_mapping);
+    m_buffer.swap(other.m_buffer);
+}
+
+bool MappedFile::open(const string& file)
+{
+    close();
+
+#ifndef _WIN32
+    int fd = ::open(file.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    //an empty file can't be mapped, but it is still a valid (empty) file
+    if (size == 0)
+    {
+        ::close(fd);
+        return true;
+    }
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    //the mapping stays valid after the descriptor is closed
+    ::close(fd);
+    if (mapping != MAP_FAILED)
+    {
+        m_mapping = mapping;
+        m_data = static_cast<const char*>(mapping);
+        m_size = size;
+        return true;
+    }
+#endif
+
+    //no mmap, so read the whole file instead
+    ifstream inf(file, ios::binary | ios::ate);
+    if (!inf)
+        return false;
+    size_t length = static_cast<size_t>(inf.tellg());
+    vector<uint64_t> buffer((length + 7) / 8);
+    inf.seekg(0);
+    if (!inf.read(reinterpret_cast<char*>(buffer.data()), length))
+        return false;
+    m_buffer.swap(buffer);
+    m_data = reinterpret_cast<const char*>(m_buffer.data());
+    m_size = length;
+    return true;
+}
+
+uint64_t checksumWords(const char* data, size_t size)
+{
+    uint64_t h = 0x9E3779B97F4A7C15ull;
+    for (size_t i = 0; i + 8 <= size; i += 8)
+    {
+        uint64_t w;
+        memcpy(&w, data + i, 8);
+        h = (h ^ w) * 0x100000001B3ull;
+        h = (h << 31) | (h >> 33);
+    }
+    return h;
+}
@@ -0,0 +1,42 @@
+#ifndef MAPPEDFILE_INCLUDED
+#define MAPPEDFILE_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Read-only view of a whole file.  Uses mmap where it is available and
+// falls back to reading the file into an (8 byte aligned) buffer elsewhere.
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+    bool open(const std::string& file);
+    void close();
+    const char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+    void swap(MappedFile& other);
+
+    // C++11 syntax for preventing copying and assignment
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+private:
+    const char* m_data;
+    size_t m_size;
+    void* m_mapping;                // non-null only for an mmap'ed file
+    std::vector<uint64_t> m_buffer; // used when the file could not be mapped
+};
+
+// Helpers for the binary images kept in snapshot files: round n up to the next
+// multiple of 8, and a word at a time checksum of a section whose size is a
+// multiple of 8.
+inline uint64_t align8(uint64_t n)
+{
+    return (n + 7) & ~uint64_t(7);
+}
+uint64_t checksumWords(const char* data, size_t size);
+
+#endif // MAPPEDFILE_INCLUDED
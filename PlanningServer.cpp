@@ -0,0 +1,438 @@
+#include "PlanningServer.h"
+
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+
+#ifndef _WIN32
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+    //requests waiting for a worker, per worker, before readers have to wait
+    const size_t QUEUED_PER_WORKER = 4;
+
+    //how long to wait before accepting again when out of descriptors or memory
+    const int ACCEPT_RETRY_MS = 100;
+
+    //a client that takes longer than this to make room for a reply is dropped, so
+    //one that never reads can't hold a worker for more than this at a time
+    const int WRITE_TIMEOUT_SECONDS = 10;
+
+    //"lat lon", both numbers
+    bool parseCoord(const string& text, GeoCoord& gc)
+    {
+        istringstream iss(text);
+        string lat, lon, extra;
+        if (!(iss >> lat >> lon) || (iss >> extra))
+            return false;
+        for (const string* number : { &lat, &lon })
+        {
+            char* end;
+            strtod(number->c_str(), &end);
+            if (*end != '\0')
+                return false;
+        }
+        gc = GeoCoord(lat, lon);
+        return true;
+    }
+}
+
+// Where the replies to one stream of requests go.  Each reply is written whole,
+// under the lock, so replies from different workers never interleave.
+class PlanningServer::Channel
+{
+public:
+    virtual ~Channel() {}
+
+    //a request was submitted, so one more reply is owed
+    void expect()
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_pending++;
+    }
+    void reply(const string& block)
+    {
+        lock_guard<mutex> lock(m_mutex);
+        write(block);
+        m_pending--;
+        m_replied.notify_all();
+    }
+    void waitForReplies()
+    {
+        unique_lock<mutex> lock(m_mutex);
+        m_replied.wait(lock, [this] { return m_pending == 0; });
+    }
+
+protected:
+    virtual void write(const string& block) = 0;
+
+private:
+    mutex m_mutex;
+    condition_variable m_replied;
+    size_t m_pending = 0;
+};
+
+class PlanningServer::StreamChannel : public PlanningServer::Channel
+{
+public:
+    StreamChannel(ostream& out) : m_out(out) {}
+protected:
+    void write(const string& block) override
+    {
+        m_out << block;
+        m_out.flush();
+    }
+private:
+    ostream& m_out;
+};
+
+#ifndef _WIN32
+// Owns a connected socket, closed once the last reply has been written.
+class PlanningServer::SocketChannel : public PlanningServer::Channel
+{
+public:
+    SocketChannel(int fd) : m_fd(fd), m_dropped(false) {}
+    ~SocketChannel() { close(m_fd); }
+protected:
+    void write(const string& block) override
+    {
+        //a client that has gone away, or stopped reading for WRITE_TIMEOUT_SECONDS
+        //(the socket's send timeout), is dropped: its reader sees the end of its
+        //requests and the rest of its replies are thrown away
+        size_t sent = 0;
+        while (!m_dropped && sent < block.size())
+        {
+            ssize_t n = ::write(m_fd, block.data() + sent, block.size() - sent);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+            {
+                m_dropped = true;
+                shutdown(m_fd, SHUT_RDWR);
+                return;
+            }
+            sent += n;
+        }
+    }
+private:
+    int m_fd;
+    bool m_dropped;     // guarded by the channel's lock, which write is called under
+};
+#endif
+
+PlanningServer::PlanningServer(const StreetMap* sm, int threads)
+    :m_streets(sm), m_stopping(false), m_stats(nullptr), m_listener(-1), m_stopRequested(false)
+{
+    if (threads <= 0)
+        threads = max(1, static_cast<int>(thread::hardware_concurrency()));
+    m_maxQueued = QUEUED_PER_WORKER * threads;
+    for (int i = 0; i < threads; i++)
+        m_workers.push_back(thread(&PlanningServer::work, this));
+}
+
+PlanningServer::~PlanningServer()
+{
+    //the workers finish whatever is queued first
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_queued.notify_all();
+    for (thread& worker : m_workers)
+        worker.join();
+}
+
+void PlanningServer::setStats(PlannerStats* stats)
+{
+    lock_guard<mutex> lock(m_mutex);
+    m_stats = stats;
+}
+
+void PlanningServer::stop()
+{
+    //only atomics and shutdown, so a signal handler can call this
+    m_stopRequested = true;
+#ifndef _WIN32
+    int listener = m_listener;
+    if (listener >= 0)
+        shutdown(listener, SHUT_RDWR);
+#endif
+}
+
+void PlanningServer::serve(istream& in, ostream& out)
+{
+    shared_ptr<Channel> channel = make_shared<StreamChannel>(out);
+    string line;
+    while (getline(in, line))
+        submit(line, channel);
+    channel->waitForReplies();
+}
+
+bool PlanningServer::serveSocket(const string& path)
+{
+#ifdef _WIN32
+    (void)path;
+    return false;
+#else
+    //a client hanging up before its replies are written mustn't end the server
+    signal(SIGPIPE, SIG_IGN);
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path))
+        return false;
+    strcpy(address.sun_path, path.c_str());
+
+    //only ever replace a socket, never a map or anything else given by mistake
+    struct stat existing;
+    if (lstat(path.c_str(), &existing) == 0)
+    {
+        if (!S_ISSOCK(existing.st_mode) || unlink(path.c_str()) != 0)
+            return false;
+    }
+    else if (errno != ENOENT)
+        return false;
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0)
+        return false;
+    if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0)
+    {
+        close(listener);
+        return false;
+    }
+
+    //stop shuts the listener down to wake accept, so it has to be able to see it;
+    //a stop that came first is seen here instead
+    m_listener = listener;
+
+    //one reader per connection; the workers are shared
+    bool stopped = false;
+    for (;;)
+    {
+        int fd = m_stopRequested ? -1 : accept(listener, nullptr, nullptr);
+        joinReaders(false);
+        if (m_stopRequested)
+        {
+            if (fd >= 0)
+                close(fd);
+            stopped = true;
+            break;
+        }
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED || errno == EPROTO)
+                continue;
+            //out of descriptors or memory is normal under load: wait for some to be freed
+            if (errno == EMFILE || errno == ENFILE || errno == ENOMEM || errno == ENOBUFS)
+            {
+                this_thread::sleep_for(chrono::milliseconds(ACCEPT_RETRY_MS));
+                continue;
+            }
+            break;
+        }
+        //bound how long writing a reply can wait on a client that doesn't read
+        timeval timeout;
+        timeout.tv_sec = WRITE_TIMEOUT_SECONDS;
+        timeout.tv_usec = 0;
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        lock_guard<mutex> lock(m_readersMutex);
+        m_connections.push_back(fd);
+        m_readers.push_back(thread(&PlanningServer::readConnection, this, fd));
+    }
+    m_listener = -1;
+    close(listener);
+    unlink(path.c_str());
+
+    //stop reading from every connection still open, and wait for the readers;
+    //requests already read are still answered, as the workers finish the queue
+    {
+        lock_guard<mutex> lock(m_readersMutex);
+        for (int fd : m_connections)
+            shutdown(fd, SHUT_RD);
+    }
+    joinReaders(true);
+    return stopped;
+#endif
+}
+
+void PlanningServer::readConnection(int fd)
+{
+#ifdef _WIN32
+    (void)fd;
+#else
+    shared_ptr<Channel> channel = make_shared<SocketChannel>(fd);
+    string pending;
+    char buffer[65536];
+    for (;;)
+    {
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        //submit every complete line, keeping any partial one for the next read
+        pending.append(buffer, n);
+        size_t start = 0;
+        for (size_t newline; (newline = pending.find('\n', start)) != string::npos; start = newline + 1)
+            submit(pending.substr(start, newline - start), channel);
+        pending.erase(0, start);
+    }
+    if (!pending.empty())
+        submit(pending, channel);
+
+    //the channel keeps the socket open until its last reply is written
+    lock_guard<mutex> lock(m_readersMutex);
+    m_connections.erase(find(m_connections.begin(), m_connections.end(), fd));
+    m_finished.push_back(this_thread::get_id());
+#endif
+}
+
+void PlanningServer::joinReaders(bool all)
+{
+    //take the threads to join out of the list first, as they need the lock to finish
+    vector<thread> done;
+    {
+        lock_guard<mutex> lock(m_readersMutex);
+        for (size_t i = 0; i < m_readers.size(); )
+        {
+            if (all || find(m_finished.begin(), m_finished.end(), m_readers[i].get_id()) != m_finished.end())
+            {
+                done.push_back(move(m_readers[i]));
+                m_readers.erase(m_readers.begin() + i);
+            }
+            else
+                i++;
+        }
+    }
+    for (thread& reader : done)
+    {
+        thread::id id = reader.get_id();
+        reader.join();
+        lock_guard<mutex> lock(m_readersMutex);
+        m_finished.erase(remove(m_finished.begin(), m_finished.end(), id), m_finished.end());
+    }
+}
+
+void PlanningServer::submit(const string& request, const shared_ptr<Channel>& replyTo)
+{
+    //blank lines (and a stray \r from the other end) aren't requests
+    string line = request;
+    if (!line.empty() && line.back() == '\r')
+        line.pop_back();
+    if (line.find_first_not_of(" \t") == string::npos)
+        return;
+
+    replyTo->expect();
+    {
+        unique_lock<mutex> lock(m_mutex);
+        m_taken.wait(lock, [this] { return m_jobs.size() < m_maxQueued; });
+        m_jobs.push_back(Job{ line, replyTo });
+    }
+    m_queued.notify_one();
+}
+
+void PlanningServer::work()
+{
+    //one thread per plan; the pool is what runs plans in parallel
+    DeliveryPlanner planner(m_streets);
+    planner.setThreadLimit(1);
+    //counted here, then added to the server's stats, so workers don't share counters
+    PlannerStats counted;
+    for (;;)
+    {
+        Job job;
+        bool counting;
+        {
+            unique_lock<mutex> lock(m_mutex);
+            m_queued.wait(lock, [this] { return m_stopping || !m_jobs.empty(); });
+            if (m_jobs.empty())
+                return;
+            job = move(m_jobs.front());
+            m_jobs.pop_front();
+            counting = m_stats != nullptr;
+        }
+        m_taken.notify_one();
+        planner.setStats(counting ? &counted : nullptr);
+        job.replyTo->reply(plan(planner, job.request));
+        if (counting)
+        {
+            lock_guard<mutex> lock(m_mutex);
+            if (m_stats != nullptr)
+                *m_stats += counted;
+            counted = PlannerStats();
+        }
+    }
+}
+
+string PlanningServer::plan(DeliveryPlanner& planner, const string& request) const
+{
+    //split into id, depot and deliveries
+    vector<string> fields;
+    for (size_t start = 0; ; )
+    {
+        size_t bar = request.find('|', start);
+        fields.push_back(request.substr(start, bar - start));
+        if (bar == string::npos)
+            break;
+        start = bar + 1;
+    }
+    const string& id = fields[0];
+    string reply;
+    GeoCoord depot;
+    vector<DeliveryRequest> deliveries;
+    bool parsed = fields.size() >= 2 && parseCoord(fields[1], depot);
+    for (size_t i = 2; parsed && i < fields.size(); i++)
+    {
+        size_t colon = fields[i].find(':');
+        GeoCoord location;
+        parsed = colon != string::npos && colon + 1 < fields[i].size() && parseCoord(fields[i].substr(0, colon), location);
+        if (parsed)
+            deliveries.push_back(DeliveryRequest(fields[i].substr(colon + 1), location));
+    }
+    if (!parsed)
+        return id + "|ERROR BAD_REQUEST\n";
+
+    //each step straight into the reply, worded as DeliveryCommand::description does
+    double miles;
+    char number[32];
+    DeliveryResult result = planner.streamDeliveryPlan(depot, deliveries, [&](const DeliveryStep& step) {
+        reply += id;
+        switch (step.kind)
+        {
+          case DeliveryStep::PROCEED:
+            snprintf(number, sizeof(number), "%.2f", step.distance);
+            reply.append("|Proceed ").append(step.direction).append(" on ").append(step.streetName)
+                 .append(" for ").append(number).append(" miles\n");
+            break;
+          case DeliveryStep::TURN:
+            reply.append("|Turn ").append(step.direction).append(" on ").append(step.streetName).append("\n");
+            break;
+          case DeliveryStep::DELIVER:
+            reply.append("|DELIVER ").append(step.item).append("\n");
+            break;
+        }
+    }, miles);
+
+    if (result == BAD_COORD)
+        return id + "|ERROR BAD_COORD\n";
+    if (result == NO_ROUTE)
+        return id + "|ERROR NO_ROUTE\n";
+    snprintf(number, sizeof(number), "%.2f", miles);
+    return reply + id + "|DONE " + number + "\n";
+}
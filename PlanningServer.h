@@ -0,0 +1,100 @@
+#ifndef PLANNINGSERVER_INCLUDED
+#define PLANNINGSERVER_INCLUDED
+
+#include "provided.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Plans deliveries for a stream of requests against one map, loaded once by the
+// caller, so a request costs only its own planning.  Requests are one per line:
+//
+//   id|depotLat depotLon|lat lon:item|lat lon:item|...
+//
+// and the reply to each is a block of lines, each starting with the request's id:
+//
+//   id|Proceed northwest on South Barrington Avenue for 0.44 miles
+//   id|DELIVER Chicken tenders (Sproul Landing)
+//   ...
+//   id|DONE 8.23                  (miles travelled)
+//
+// or the single line id|ERROR BAD_COORD, id|ERROR NO_ROUTE or id|ERROR BAD_REQUEST.
+// Items can't contain '|'.  Requests are planned on a pool of workers, each with
+// a planner of its own, and a reply is written whole as soon as it is ready, so
+// replies can come back in a different order from the requests.
+class PlanningServer
+{
+public:
+    // threads workers, 0 for one per hardware thread; sm must outlive the server
+    PlanningServer(const StreetMap* sm, int threads = 0);
+    ~PlanningServer();
+
+    // add the counters and times of every plan to stats, under the server's lock
+    // (nullptr, the default, to stop); read it once serving is over
+    void setStats(PlannerStats* stats);
+
+    // plan every request read from in until it ends, replying to out; returns
+    // once every reply has been written
+    void serve(std::istream& in, std::ostream& out);
+    // listen on a Unix domain socket at path and serve each connection as serve
+    // does, all sharing the workers.  A socket left at path by an earlier server is
+    // replaced, but any other kind of file there is left alone and nothing is
+    // served.  A client that doesn't make room for a reply within a few seconds is
+    // disconnected.  Returns true once stop is called, or false if the socket
+    // can't be set up, sockets aren't available here, or accepting connections
+    // fails for good.  Once it has returned the socket is gone and no more
+    // requests are read, but those already read are answered before the server
+    // is destroyed.
+    bool serveSocket(const std::string& path);
+    // make serveSocket stop accepting connections and return; safe to call from
+    // another thread or a signal handler, and before serveSocket has started
+    void stop();
+
+    // C++11 syntax for preventing copying and assignment
+    PlanningServer(const PlanningServer&) = delete;
+    PlanningServer& operator=(const PlanningServer&) = delete;
+
+private:
+    class Channel;
+    class StreamChannel;
+    class SocketChannel;
+
+    struct Job
+    {
+        std::string request;
+        std::shared_ptr<Channel> replyTo;
+    };
+
+    const StreetMap* m_streets;
+    size_t m_maxQueued;
+    std::mutex m_mutex;
+    std::condition_variable m_queued;    // a job was added, or the server is stopping
+    std::condition_variable m_taken;     // a job was taken, so there is room for another
+    std::deque<Job> m_jobs;
+    bool m_stopping;
+    std::vector<std::thread> m_workers;
+    PlannerStats* m_stats;               // guarded by m_mutex
+
+    // one reader thread per socket connection
+    std::mutex m_readersMutex;
+    std::vector<std::thread> m_readers;
+    std::vector<int> m_connections;              // sockets still being read
+    std::vector<std::thread::id> m_finished;     // readers done, not yet joined
+    std::atomic<int> m_listener;                 // the listening socket, -1 if none
+    std::atomic<bool> m_stopRequested;
+
+    void submit(const std::string& request, const std::shared_ptr<Channel>& replyTo);
+    void work();
+    void readConnection(int fd);
+    void joinReaders(bool all);
+    std::string plan(DeliveryPlanner& planner, const std::string& request) const;
+};
+
+#endif // PLANNINGSERVER_INCLUDED
@@ -1,11 +1,39 @@
 #include "provided.h"
-#include "ExpandableHashMap.h"
+#include "FlatHashMap.h"
+#include "StreetGraph.h"
+#include "ContractionHierarchy.h"
+#include "LandmarkIndex.h"
+#include "RouteCache.h"
 #include <list>
 #include <vector>
 #include <queue>
-#include <memory>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
 using namespace std;
 
+namespace
+{
+    //a graph node id as a hash map key
+    struct NodeId
+    {
+        uint32_t node;
+    };
+
+    bool operator==(const NodeId& lhs, const NodeId& rhs)
+    {
+        return lhs.node == rhs.node;
+    }
+}
+
+// node ids are distinct small integers, which FlatHashMap's Fibonacci hashing
+// already spreads well
+unsigned int hasher(const NodeId& id)
+{
+    return id.node;
+}
+
 class PointToPointRouterImpl
 {
 public:
@@ -16,30 +44,158 @@ public:
         const GeoCoord& end,
         list<StreetSegment>& route,
         double& totalDistanceTravelled) const;
+    DeliveryResult generatePointToPointPath(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        vector<RouteStep>& path,
+        double& totalDistanceTravelled) const;
+    void setSearchMode(RouteSearchMode mode) { m_mode = mode; }
+    void setRouteCacheCapacity(int capacity) { m_cache.setCapacity(capacity); }
+    RouteCacheStats routeCacheStats() const { return m_cache.stats(); }
+    void setStats(PlannerStats* stats) { m_stats = stats; }
 private:
+    static const uint32_t NO_CELL = 0xFFFFFFFF;
+
+    //a node reached by the search; cells live in one pool and refer to each other by index
     struct SearchCell
     {
+        uint32_t node;          //graph node id
+        uint32_t parent;        //pool index of the cell we got here from, NO_CELL for the start
+        uint32_t edge;          //graph edge between the parent's node and this one
         bool visited = false;
-        GeoCoord coord;
-        shared_ptr<SearchCell> parent;
-        double L = INFINITY; //local goal
-        double G = INFINITY; //global goal
-        StreetSegment segment;
-
-        SearchCell(GeoCoord coord, shared_ptr<SearchCell> parent)
-            :coord(coord), parent(parent)
+        double L = INFINITY;    //local goal
+        double G = INFINITY;    //global goal
+
+        SearchCell(uint32_t node)
+            :node(node), parent(NO_CELL), edge(0)
+        {
+        }
+    };
+
+    //open list entry; entries whose G is out of date are skipped when popped
+    struct OpenEntry
+    {
+        double G;
+        uint32_t cell;
+        bool operator>(const OpenEntry& other) const { return G > other.G; }
+    };
+
+    //the state of a search in one direction: the pool of cells, where each node's
+    //cell is in it, and the open list, a min-heap on global distance
+    struct SearchSide
+    {
+        vector<SearchCell> cells;
+        FlatHashMap<NodeId, uint32_t> cellOf;
+        priority_queue<OpenEntry, vector<OpenEntry>, greater<OpenEntry>> notTestedList;
+        //for PlannerStats
+        uint64_t settled = 0;
+        uint64_t pushes = 0;
+        uint64_t pops = 0;
+        uint64_t probes = 0;
+
+        SearchSide()
         {
+            cells.reserve(256);
+            cellOf.reserve(256);
         }
-        SearchCell(GeoCoord coord, shared_ptr<SearchCell> parent, StreetSegment segment)
-            :coord(coord), parent(parent), segment(segment)
+
+        //the cell for node, making one the first time the node is reached
+        uint32_t cellFor(uint32_t node)
         {
+            probes++;
+            pair<uint32_t*, bool> found = cellOf.try_emplace(NodeId{ node }, static_cast<uint32_t>(cells.size()));
+            if (found.second)
+                cells.push_back(SearchCell(node));
+            return *found.first;
+        }
+
+        const SearchCell* find(uint32_t node)
+        {
+            probes++;
+            const uint32_t* cell = cellOf.find(NodeId{ node });
+            return cell == nullptr ? nullptr : &cells[*cell];
+        }
+
+        //lower a cell's distances and (re)open it
+        void improve(uint32_t cell, uint32_t parent, uint32_t edge, double L, double G)
+        {
+            SearchCell& c = cells[cell];
+            c.parent = parent;
+            c.edge = edge;
+            c.L = L;
+            c.G = G;
+            //a shorter way to a visited cell means it has to be looked at again
+            c.visited = false;
+            notTestedList.push(OpenEntry{ G, cell });
+            pushes++;
+        }
+
+        //the open cell with the lowest global distance, dropping stale entries; NO_CELL if none
+        uint32_t nextCell()
+        {
+            while (!notTestedList.empty())
+            {
+                OpenEntry top = notTestedList.top();
+                if (!cells[top.cell].visited && top.G <= cells[top.cell].G)
+                    return top.cell;
+                notTestedList.pop();
+                pops++;
+            }
+            return NO_CELL;
+        }
+
+        //take the cell nextCell returned off the open list, its distance now final
+        void settle(uint32_t cell)
+        {
+            notTestedList.pop();
+            cells[cell].visited = true;
+            pops++;
+            settled++;
+        }
+
+        //add the counters to work, if anyone wants them
+        void count(PlannerStats* work) const
+        {
+            if (work == nullptr)
+                return;
+            work->nodesExpanded += settled;
+            work->openPushes += pushes;
+            work->openPops += pops;
+            work->hashProbes += probes;
+            work->bytesAllocated += cells.capacity() * sizeof(SearchCell);
+        }
+    };
+
+    //lower bound on the road distance between two nodes: the crow flies distance,
+    //raised to the landmark bound when the map has landmarks
+    struct DistanceBound
+    {
+        const StreetGraph& graph;
+        const LandmarkIndex& landmarks;
+
+        double operator()(uint32_t a, uint32_t b) const
+        {
+            double bound = graph.distanceMiles(a, b);
+            if (!landmarks.empty())
+                bound = max(bound, landmarks.lowerBound(a, b));
+            return bound;
         }
     };
 
     const StreetMap* streets;
+    RouteSearchMode m_mode;
+    mutable RouteCache m_cache;     //locks internally, so the const router can fill it
+    PlannerStats* m_stats;
+
+    DeliveryResult findPath(const GeoCoord& start, const GeoCoord& end, vector<RouteStep>& path,
+                            double& totalDistanceTravelled, PlannerStats* work) const;
+    bool aStarSearch(uint32_t startNode, uint32_t endNode, vector<RouteStep>& path, double& distance, PlannerStats* work) const;
+    bool bidirectionalSearch(uint32_t startNode, uint32_t endNode, vector<RouteStep>& path, double& distance, PlannerStats* work) const;
+    bool hierarchySearch(uint32_t startNode, uint32_t endNode, vector<RouteStep>& path, double& distance, PlannerStats* work) const;
 };
 
 PointToPointRouterImpl::PointToPointRouterImpl(const StreetMap* sm)
+    :m_mode(SEARCH_ASTAR), m_stats(nullptr)
 {
     streets = sm;
 }
@@ -54,159 +210,272 @@ DeliveryResult PointToPointRouterImpl::generatePointToPointRoute(
         list<StreetSegment>& route,
         double& totalDistanceTravelled) const
 {
-    //pre checks
     route.clear();
+    vector<RouteStep> path;
+    DeliveryResult result = generatePointToPointPath(start, end, path, totalDistanceTravelled);
+
+    //only now turn the path into StreetSegments
+    const StreetGraph& graph = streets->graph();
+    for (const RouteStep& step : path)
+        route.push_back(graph.segment(step));
+    return result;
+}
+
+DeliveryResult PointToPointRouterImpl::generatePointToPointPath(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        vector<RouteStep>& path,
+        double& totalDistanceTravelled) const
+{
+    //counting and timing only when someone wants them, every route whatever the result
+    if (m_stats == nullptr)
+        return findPath(start, end, path, totalDistanceTravelled, nullptr);
+    chrono::steady_clock::time_point started = chrono::steady_clock::now();
+    PlannerStats work;
+    DeliveryResult result = findPath(start, end, path, totalDistanceTravelled, &work);
+    work.routes++;
+    work.routeSeconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+    *m_stats += work;
+    return result;
+}
+
+DeliveryResult PointToPointRouterImpl::findPath(const GeoCoord& start, const GeoCoord& end, vector<RouteStep>& path,
+                                                double& totalDistanceTravelled, PlannerStats* work) const
+{
+    //pre checks
+    path.clear();
     totalDistanceTravelled = 0;
 
-    vector<StreetSegment> garbage;
-    if (!(streets->getSegmentsThatStartWith(start, garbage)))
-        return BAD_COORD;
-    if (!(streets->getSegmentsThatStartWith(end, garbage)))
+    const StreetGraph& graph = streets->graph();
+    uint32_t startNode = graph.findNode(start);
+    uint32_t endNode = graph.findNode(end);
+    if (startNode == StreetGraph::NO_NODE || endNode == StreetGraph::NO_NODE)
         return BAD_COORD;
 
-    if (start == end)
+    if (startNode == endNode)
         return DELIVERY_SUCCESS;
 
-    //structure to track and store search cells
-    ExpandableHashMap<GeoCoord, shared_ptr<SearchCell>> cellMap; 
-
-    //initialize the start and end cells and add them to the structure
-    shared_ptr<SearchCell> cellStart = shared_ptr<SearchCell>(new SearchCell(start, nullptr));
-    shared_ptr<SearchCell> cellEnd = shared_ptr<SearchCell>(new SearchCell(end, nullptr));;
-    cellMap.associate(start, cellStart);
-    cellMap.associate(end, cellEnd);
-    //create and set current cell to the start
-    shared_ptr<SearchCell> cellCurrent = cellStart;
-    //set the starting cell's local and global distances
-    cellStart->L = 0.0;
-    cellStart->G = distanceEarthMiles(cellStart->coord, cellEnd->coord);
-    //create the open list and add the starting/current cell
-    list<shared_ptr<SearchCell>> notTestedList;
-    notTestedList.push_back(cellStart);
-
-    //while the open list contains cells and the current cell isnt at the end
-    while (!notTestedList.empty() && cellCurrent != cellEnd)
+    //a landmark that reaches just one of the ends proves there is no route, and
+    //would make every bound in the search infinite, so don't search at all
+    const LandmarkIndex& landmarks = streets->landmarks();
+    if (!landmarks.empty() && landmarks.lowerBound(startNode, endNode) == INFINITY)
+        return NO_ROUTE;
+
+    double distance = 0;
+    bool found;
+    //search only if the cache (when there is one) doesn't have the route
+    if (!m_cache.lookup(graph, startNode, endNode, found, path, distance))
+    {
+        if (m_mode == SEARCH_CONTRACTION_HIERARCHY && !streets->hierarchy().empty())
+            found = hierarchySearch(startNode, endNode, path, distance, work);
+        else if (m_mode == SEARCH_BIDIRECTIONAL_ASTAR || m_mode == SEARCH_CONTRACTION_HIERARCHY)
+            found = bidirectionalSearch(startNode, endNode, path, distance, work);
+        else
+            found = aStarSearch(startNode, endNode, path, distance, work);
+        m_cache.store(graph, startNode, endNode, found, path, distance);
+    }
+    else if (work != nullptr)
+        work->cacheHits++;
+    if (!found)
+        return NO_ROUTE;
+    totalDistanceTravelled = distance;
+    return DELIVERY_SUCCESS;
+}
+
+bool PointToPointRouterImpl::aStarSearch(uint32_t startNode, uint32_t endNode, vector<RouteStep>& path, double& distance, PlannerStats* work) const
+{
+    const StreetGraph& graph = streets->graph();
+    DistanceBound bound{ graph, streets->landmarks() };
+    SearchSide search;
+
+    //start with just the starting cell on the open list
+    uint32_t cellStart = search.cellFor(startNode);
+    search.improve(cellStart, NO_CELL, 0, 0.0, bound(startNode, endNode));
+
+    uint32_t cellEnd = NO_CELL;
+    for (uint32_t current = search.nextCell(); current != NO_CELL; current = search.nextCell())
     {
-        //sort the open list from lowest to highest global distance
-        notTestedList.sort([](const shared_ptr<SearchCell> lhs, const shared_ptr<SearchCell> rhs) {return lhs->G < rhs->G;});
-
-        //pop visited cells off the list
-        while (!notTestedList.empty() && notTestedList.front()->visited)
-            notTestedList.pop_front();
-        //since cells may have been popped, check again if the open list is empty
-        if (notTestedList.empty())
+        search.settle(current);
+
+        //the end is settled, so its local distance is final
+        if (search.cells[current].node == endNode)
+        {
+            cellEnd = current;
             break;
+        }
 
-        //condition for final cell's segment
-        shared_ptr<SearchCell> previous = nullptr;
-        //if the current cell is about to be set to the final cell
-        //track the second to last cell
-        if (notTestedList.front() == cellEnd)
+        uint32_t node = search.cells[current].node;
+        for (const StreetEdge* e = graph.edgesBegin(node); e != graph.edgesEnd(node); e++)
         {
-            previous = cellCurrent;
+            uint32_t neighbor = search.cellFor(e->to);
+            //if going through the current cell is shorter, use it on the path
+            double goal = search.cells[current].L + e->length;
+            if (goal < search.cells[neighbor].L)
+                search.improve(neighbor, current, graph.edgeIndex(e), goal, goal + bound(e->to, endNode));
         }
-        
-        //set current cell to the first cell on the open list
-        cellCurrent = notTestedList.front();
-        //mark this cell as visited
-        cellCurrent->visited = true;
-
-
-        //create a vector to store the segments that start with the current cell's coord
-        vector<StreetSegment> temp;
-        streets->getSegmentsThatStartWith(cellCurrent->coord, temp);
-        //for every segment in the vector
-        vector<StreetSegment>::iterator it = temp.begin();
-        for (; it != temp.end();it++)
+    }
+
+    search.count(work);
+
+    //the open list ran out without reaching the end
+    if (cellEnd == NO_CELL)
+        return false;
+
+    //trace back down the path until reach the first cell
+    for (uint32_t p = cellEnd; search.cells[p].parent != NO_CELL; p = search.cells[p].parent)
+    {
+        const SearchCell& c = search.cells[p];
+        path.push_back(RouteStep{ search.cells[c.parent].node, c.node, c.edge });
+    }
+    reverse(path.begin(), path.end());
+    //the final cell's L distance equals the distances along the path
+    distance = search.cells[cellEnd].L;
+    return true;
+}
+
+// Bidirectional A* with the average potential p(v) = (h(v,end) - h(start,v)) / 2,
+// h being the lower bound plain A* uses: the forward search orders cells by L + p(v)
+// and the backward search (which follows edges out of each node, fine because every
+// segment is stored in both directions) by L - p(v).  Both see the same nonnegative
+// reduced edge lengths, so the search can stop as soon as the two smallest open
+// keys add up to the best meeting distance.
+bool PointToPointRouterImpl::bidirectionalSearch(uint32_t startNode, uint32_t endNode, vector<RouteStep>& path, double& distance, PlannerStats* work) const
+{
+    const StreetGraph& graph = streets->graph();
+    DistanceBound bound{ graph, streets->landmarks() };
+    auto potential = [&](uint32_t node) {
+        return 0.5 * (bound(node, endNode) - bound(startNode, node));
+    };
+
+    SearchSide forward;
+    SearchSide backward;
+    forward.improve(forward.cellFor(startNode), NO_CELL, 0, 0.0, potential(startNode));
+    backward.improve(backward.cellFor(endNode), NO_CELL, 0, 0.0, -potential(endNode));
+
+    double best = INFINITY;
+    uint32_t meetNode = StreetGraph::NO_NODE;
+    for (;;)
+    {
+        uint32_t f = forward.nextCell();
+        uint32_t b = backward.nextCell();
+        //once either side runs out, every path it could still complete is known
+        if (f == NO_CELL || b == NO_CELL)
+            break;
+        if (forward.cells[f].G + backward.cells[b].G >= best)
+            break;
+
+        //advance whichever side has the smaller key
+        bool goForward = forward.cells[f].G <= backward.cells[b].G;
+        SearchSide& side = goForward ? forward : backward;
+        SearchSide& other = goForward ? backward : forward;
+        double sign = goForward ? 1.0 : -1.0;
+        uint32_t current = goForward ? f : b;
+        side.settle(current);
+
+        uint32_t node = side.cells[current].node;
+        for (const StreetEdge* e = graph.edgesBegin(node); e != graph.edgesEnd(node); e++)
         {
-            //try to locate a cell in the cell map
-            auto neighborPointer = cellMap.find((*it).end);
-            
-            //if this cell exists
-            if (neighborPointer != nullptr && *neighborPointer != nullptr)
+            uint32_t neighbor = side.cellFor(e->to);
+            double goal = side.cells[current].L + e->length;
+            if (goal < side.cells[neighbor].L)
             {
-                //set neighbor to a neighboring cell
-                auto neighbor = *neighborPointer;
-                
-                //if this is the final cell and neighbor is the cell before it on the path
-                if (cellCurrent == cellEnd && neighbor == previous)
+                side.improve(neighbor, current, graph.edgeIndex(e), goal, goal + sign * potential(e->to));
+                //a cheaper path through this node, if the other side has reached it too
+                const SearchCell* met = other.find(e->to);
+                if (met != nullptr && goal + met->L < best)
                 {
-                    //generate and associate the segment connecting the two
-                    StreetSegment newSeg;
-                    newSeg.start = (*it).end;
-                    newSeg.end = (*it).start;
-                    newSeg.name = (*it).name;
-                    cellEnd->segment = newSeg;
+                    best = goal + met->L;
+                    meetNode = e->to;
                 }
+            }
+        }
+    }
 
-                //if the neighbor has not been visited, add it to the open list
-                if (!(neighbor->visited))
-                    notTestedList.push_back(neighbor);
+    forward.count(work);
+    backward.count(work);
+    if (meetNode == StreetGraph::NO_NODE)
+        return false;
 
-                //set a variable goal to the current cell's local distance plus the distance from itself to the neighbor
-                double goal = cellCurrent->L + distanceEarthMiles(cellCurrent->coord, neighbor->coord);
-                //if goal is less than the neighbor's local distance
-                if (goal < neighbor->L)
-                {
-                    //use it on the path and update its information in the cell map
-                    neighbor->parent = cellCurrent;
-                    neighbor->L = goal;
-                    neighbor->G = neighbor->L + distanceEarthMiles(neighbor->coord, cellEnd->coord);
-                    cellMap.associate((*it).end, shared_ptr<SearchCell>(new SearchCell((*it).end, cellCurrent, *it)));
-                }
-                
-                    
-            }
-            else //geocoord is not in the map
+    //start to the meeting node, traced back from the meeting node and reversed
+    for (const SearchCell* c = forward.find(meetNode); c->parent != NO_CELL; c = &forward.cells[c->parent])
+        path.push_back(RouteStep{ forward.cells[c->parent].node, c->node, c->edge });
+    reverse(path.begin(), path.end());
+    //then the meeting node to the end; these edges were followed end to start
+    for (const SearchCell* c = backward.find(meetNode); c->parent != NO_CELL; c = &backward.cells[c->parent])
+        path.push_back(RouteStep{ c->node, backward.cells[c->parent].node, c->edge });
+
+    distance = best;
+    return true;
+}
+
+
+// Dijkstra from both ends over the hierarchy's up arcs only.  Each side's search
+// space is just the nodes above its end, so it stays small; a side is finished once
+// its smallest open distance can't beat the best meeting found, and the arcs on the
+// winning path are unpacked into street edges afterwards.
+bool PointToPointRouterImpl::hierarchySearch(uint32_t startNode, uint32_t endNode, vector<RouteStep>& path, double& distance, PlannerStats* work) const
+{
+    const ContractionHierarchy& hierarchy = streets->hierarchy();
+
+    SearchSide forward;
+    SearchSide backward;
+    forward.improve(forward.cellFor(startNode), NO_CELL, ContractionHierarchy::NO_ARC, 0.0, 0.0);
+    backward.improve(backward.cellFor(endNode), NO_CELL, ContractionHierarchy::NO_ARC, 0.0, 0.0);
+
+    double best = INFINITY;
+    uint32_t meetNode = StreetGraph::NO_NODE;
+    for (;;)
+    {
+        uint32_t f = forward.nextCell();
+        uint32_t b = backward.nextCell();
+        bool forwardDone = f == NO_CELL || forward.cells[f].L >= best;
+        bool backwardDone = b == NO_CELL || backward.cells[b].L >= best;
+        if (forwardDone && backwardDone)
+            break;
+
+        bool goForward = !forwardDone && (backwardDone || forward.cells[f].L <= backward.cells[b].L);
+        SearchSide& side = goForward ? forward : backward;
+        SearchSide& other = goForward ? backward : forward;
+        uint32_t current = goForward ? f : b;
+        side.settle(current);
+
+        uint32_t node = side.cells[current].node;
+        for (const ContractionHierarchy::UpArc* up = hierarchy.upBegin(node); up != hierarchy.upEnd(node); up++)
+        {
+            uint32_t neighbor = side.cellFor(up->to);
+            double goal = side.cells[current].L + up->length;
+            if (goal < side.cells[neighbor].L)
             {
-                //add the cell to the map
-                cellMap.associate((*it).end, shared_ptr<SearchCell>(new SearchCell((*it).end, cellCurrent, *it)));
-                //find neighbors
-                auto newNeighborPointer = cellMap.find((*it).end);
-                shared_ptr<SearchCell> newNeighbor = *newNeighborPointer;
-                notTestedList.push_back(newNeighbor);
-                //set a variable goal to the current cell's local distance plus the distance from itself to the neighbor
-                double goal = cellCurrent->L + distanceEarthMiles(cellCurrent->coord, newNeighbor->coord);
-                //if goal is less than the neighbor's local distance
-                if (goal < newNeighbor->L)
+                side.improve(neighbor, current, up->arc, goal, goal);
+                const SearchCell* met = other.find(up->to);
+                if (met != nullptr && goal + met->L < best)
                 {
-                    //update the neighbor's members with the new distances
-                    newNeighbor->parent = cellCurrent;
-                    newNeighbor->L = goal;
-                    newNeighbor->G = newNeighbor->L + distanceEarthMiles(newNeighbor->coord, cellEnd->coord);
+                    best = goal + met->L;
+                    meetNode = up->to;
                 }
             }
         }
-
     }
 
-    //if the last cell is not nullptr
-    if (cellEnd != nullptr)
-    {
-        //set p to the last cell
-        auto p = cellEnd; 
-        //trace back down the path until reach the first cell
-        while (p != cellStart)
-        {
-            //for each cell along the path, add its segment member to the route vector
-            route.push_back(p->segment);
-            // Set next node to this node's parent
-            p = p->parent;
-        }
+    forward.count(work);
+    backward.count(work);
+    if (meetNode == StreetGraph::NO_NODE)
+        return false;
 
-        //reverse the route to get the directions from the start
-        route.reverse();
-        //add the final cell's L distance to total distance
-        //since the final cell's L distance will equal the distances along the path
-        totalDistanceTravelled += cellEnd->L;
-        return DELIVERY_SUCCESS;
-    }
+    //the arcs from the start up to the meeting node, in order, then unpacked
+    vector<const SearchCell*> climb;
+    for (const SearchCell* c = forward.find(meetNode); c->parent != NO_CELL; c = &forward.cells[c->parent])
+        climb.push_back(c);
+    for (auto it = climb.rbegin(); it != climb.rend(); it++)
+        hierarchy.unpack((*it)->edge, forward.cells[(*it)->parent].node, path);
+    //then back down from the meeting node to the end
+    for (const SearchCell* c = backward.find(meetNode); c->parent != NO_CELL; c = &backward.cells[c->parent])
+        hierarchy.unpack(c->edge, c->node, path);
 
-    //if the last cell is nullptr, return no_route
-    return NO_ROUTE; 
+    distance = best;
+    return true;
 }
 
-
 //******************** PointToPointRouter functions ***************************
 
 // These functions simply delegate to PointToPointRouterImpl's functions.
@@ -230,3 +499,32 @@ DeliveryResult PointToPointRouter::generatePointToPointRoute(
 {
     return m_impl->generatePointToPointRoute(start, end, route, totalDistanceTravelled);
 }
+
+DeliveryResult PointToPointRouter::generatePointToPointPath(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        vector<RouteStep>& path,
+        double& totalDistanceTravelled) const
+{
+    return m_impl->generatePointToPointPath(start, end, path, totalDistanceTravelled);
+}
+
+void PointToPointRouter::setSearchMode(RouteSearchMode mode)
+{
+    m_impl->setSearchMode(mode);
+}
+
+void PointToPointRouter::setRouteCacheCapacity(int capacity)
+{
+    m_impl->setRouteCacheCapacity(capacity);
+}
+
+RouteCacheStats PointToPointRouter::routeCacheStats() const
+{
+    return m_impl->routeCacheStats();
+}
+
+void PointToPointRouter::setStats(PlannerStats* stats)
+{
+    m_impl->setStats(stats);
+}
@@ -0,0 +1,152 @@
+#include "RouteCache.h"
+
+#include <algorithm>
+using namespace std;
+
+// node ids near each other on the map are often close in value, and the halves
+// of the key xored together would collide for any two routes with the same
+// start ^ end, so every bit is mixed the way coordinate keys are
+unsigned int hasher(const RouteCache::RouteKey& k)
+{
+    return static_cast<unsigned int>(StreetGraph::coordHash(k.ends));
+}
+
+RouteCache::RouteCache()
+    :m_capacity(0), m_graphChecksum(0), m_newest(NO_ENTRY), m_oldest(NO_ENTRY), m_hits(0), m_misses(0)
+{
+}
+
+void RouteCache::reset(uint64_t graphChecksum)
+{
+    m_graphChecksum = graphChecksum;
+    vector<Entry>().swap(m_entries);
+    m_index.reset();
+    m_newest = NO_ENTRY;
+    m_oldest = NO_ENTRY;
+}
+
+void RouteCache::setCapacity(int capacity)
+{
+    lock_guard<mutex> lock(m_mutex);
+    m_capacity = max(capacity, 0);
+    //start over rather than pick which routes to keep
+    reset(m_graphChecksum);
+}
+
+void RouteCache::unlink(uint32_t entry)
+{
+    Entry& e = m_entries[entry];
+    if (e.newer != NO_ENTRY)
+        m_entries[e.newer].older = e.older;
+    else
+        m_newest = e.older;
+    if (e.older != NO_ENTRY)
+        m_entries[e.older].newer = e.newer;
+    else
+        m_oldest = e.newer;
+}
+
+void RouteCache::pushNewest(uint32_t entry)
+{
+    Entry& e = m_entries[entry];
+    e.newer = NO_ENTRY;
+    e.older = m_newest;
+    if (m_newest != NO_ENTRY)
+        m_entries[m_newest].newer = entry;
+    m_newest = entry;
+    if (m_oldest == NO_ENTRY)
+        m_oldest = entry;
+}
+
+bool RouteCache::lookup(const StreetGraph& graph, uint32_t start, uint32_t end,
+                        bool& found, vector<RouteStep>& path, double& distance)
+{
+    lock_guard<mutex> lock(m_mutex);
+    if (m_capacity == 0)
+        return false;
+    if (graph.checksum() != m_graphChecksum)
+        reset(graph.checksum());
+
+    //the route asked for, or else the same route the other way round
+    bool reversed = false;
+    const uint32_t* entry = m_index.find(makeKey(start, end));
+    if (entry == nullptr)
+    {
+        entry = m_index.find(makeKey(end, start));
+        reversed = true;
+    }
+    if (entry == nullptr)
+    {
+        m_misses++;
+        return false;
+    }
+    m_hits++;
+
+    const Entry& e = m_entries[*entry];
+    found = e.found;
+    distance = e.distance;
+    if (!reversed)
+        path = e.path;
+    else
+    {
+        path.clear();
+        for (auto step = e.path.rbegin(); step != e.path.rend(); step++)
+            path.push_back(RouteStep{ step->to, step->from, step->edge });
+    }
+
+    unlink(*entry);
+    pushNewest(*entry);
+    return true;
+}
+
+void RouteCache::store(const StreetGraph& graph, uint32_t start, uint32_t end,
+                       bool found, const vector<RouteStep>& path, double distance)
+{
+    lock_guard<mutex> lock(m_mutex);
+    if (m_capacity == 0)
+        return;
+    if (graph.checksum() != m_graphChecksum)
+        reset(graph.checksum());
+
+    //another thread may have stored the same route meanwhile; else reuse the
+    //least recently used entry once the cache is full
+    RouteKey key = makeKey(start, end);
+    uint32_t entry;
+    const uint32_t* existing = m_index.find(key);
+    if (existing != nullptr)
+    {
+        entry = *existing;
+        unlink(entry);
+    }
+    else if (static_cast<int>(m_entries.size()) < m_capacity)
+    {
+        entry = static_cast<uint32_t>(m_entries.size());
+        m_entries.push_back(Entry());
+        m_index.associate(key, entry);
+    }
+    else
+    {
+        entry = m_oldest;
+        unlink(entry);
+        m_index.erase(m_entries[entry].key);
+        m_index.associate(key, entry);
+    }
+
+    Entry& e = m_entries[entry];
+    e.key = key;
+    e.found = found;
+    e.distance = distance;
+    e.path = path;
+    pushNewest(entry);
+}
+
+RouteCacheStats RouteCache::stats() const
+{
+    lock_guard<mutex> lock(m_mutex);
+    RouteCacheStats stats;
+    stats.hits = m_hits;
+    stats.misses = m_misses;
+    stats.size = static_cast<int>(m_entries.size());
+    stats.capacity = m_capacity;
+    return stats;
+}
@@ -0,0 +1,78 @@
+#ifndef ROUTECACHE_INCLUDED
+#define ROUTECACHE_INCLUDED
+
+#include "StreetGraph.h"
+#include "FlatHashMap.h"
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Bounded least recently used cache of point-to-point routes, keyed by the
+// (start, end) node pair.  A route is kept as its RouteSteps, so it costs a few
+// words per step, and a cached route from a to b also answers b to a by walking
+// it backwards (every segment is stored in both directions).  Failed searches are
+// cached too, so asking again for an impossible route is cheap.
+//
+// All operations lock, so one cache can serve threads sharing a const router.
+// The cache remembers which graph its routes are for and empties itself when
+// asked about another one.
+class RouteCache
+{
+public:
+    RouteCache();
+
+    // the most routes kept; 0 turns the cache off and empties it
+    void setCapacity(int capacity);
+
+    // look up the route from start to end; on a hit fill found, path and distance
+    bool lookup(const StreetGraph& graph, uint32_t start, uint32_t end,
+                bool& found, std::vector<RouteStep>& path, double& distance);
+    void store(const StreetGraph& graph, uint32_t start, uint32_t end,
+               bool found, const std::vector<RouteStep>& path, double distance);
+
+    RouteCacheStats stats() const;
+
+    // C++11 syntax for preventing copying and assignment
+    RouteCache(const RouteCache&) = delete;
+    RouteCache& operator=(const RouteCache&) = delete;
+
+private:
+    static const uint32_t NO_ENTRY = 0xFFFFFFFF;
+
+    //a route's start and end node ids, packed into one key
+    struct RouteKey
+    {
+        uint64_t ends;
+        bool operator==(const RouteKey& other) const { return ends == other.ends; }
+    };
+    friend unsigned int hasher(const RouteKey& k);
+
+    //entries are linked from most to least recently used
+    struct Entry
+    {
+        RouteKey key;
+        bool found;
+        double distance;
+        std::vector<RouteStep> path;
+        uint32_t newer;
+        uint32_t older;
+    };
+
+    mutable std::mutex m_mutex;
+    int m_capacity;
+    uint64_t m_graphChecksum;
+    std::vector<Entry> m_entries;
+    FlatHashMap<RouteKey, uint32_t> m_index;
+    uint32_t m_newest;
+    uint32_t m_oldest;
+    uint64_t m_hits;
+    uint64_t m_misses;
+
+    static RouteKey makeKey(uint32_t start, uint32_t end) { return RouteKey{ (uint64_t(start) << 32) | end }; }
+    void reset(uint64_t graphChecksum);
+    void unlink(uint32_t entry);
+    void pushNewest(uint32_t entry);
+};
+
+#endif // ROUTECACHE_INCLUDED
@@ -0,0 +1,687 @@
+#include "StreetGraph.h"
+
+#include <cstring>
+#include <cmath>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <functional>
+#include <utility>
+#include <algorithm>
+using namespace std;
+
+// Image layout (native byte order, every section starts on an 8 byte boundary):
+//
+//   ImageHeader
+//   NodeRecord  nodes[nodeCount]
+//   char        nodeText[]              latitude and longitude text of every node
+//   uint32_t    offsets[nodeCount + 1]  CSR offsets into edges
+//   StreetEdge  edges[edgeCount]
+//   uint32_t    nameOffsets[nameCount]  offsets into nameText
+//   char        nameText[]              NUL-terminated street names
+//   NodeSlot    slots[slotCount]        open addressed (linear probing) table of node ids by coordKey
+//   uint32_t    gridOffsets[gridRows * gridCols + 1]  CSR offsets into gridEntries
+//   GridEntry   gridEntries[]           the segments whose bounding box overlaps each cell
+//
+// The grid covers the bounding box of all nodes with gridRows x gridCols cells of
+// gridCellLat by gridCellLon degrees, starting at (gridLat0, gridLon0).  Each
+// segment is listed once, by the edge leaving its lower numbered end.
+//
+// The checksum covers everything after the header.  Bump IMAGE_VERSION whenever
+// the layout or the meaning of any field changes.
+
+namespace
+{
+    const char     IMAGE_MAGIC[8] = { 'M', 'O', 'V', 'E', 'I', 'T', 'S', 'G' };
+    const uint32_t IMAGE_VERSION = 4;
+    const uint32_t IMAGE_BYTE_ORDER = 0x01020304;
+
+    struct ImageHeader
+    {
+        char     magic[8];
+        uint32_t version;
+        uint32_t byteOrder;
+        uint64_t imageSize;
+        uint64_t checksum;
+        uint32_t nodeCount;
+        uint32_t edgeCount;
+        uint32_t nameCount;
+        uint32_t slotCount;
+        uint64_t nodesAt;
+        uint64_t nodeTextAt;
+        uint64_t offsetsAt;
+        uint64_t edgesAt;
+        uint64_t nameOffsetsAt;
+        uint64_t nameTextAt;
+        uint64_t slotsAt;
+        uint32_t gridRows;
+        uint32_t gridCols;
+        double   gridLat0;
+        double   gridLon0;
+        double   gridCellLat;
+        double   gridCellLon;
+        uint64_t gridOffsetsAt;
+        uint64_t gridEntriesAt;
+    };
+
+    // aim for about this many segments per grid cell
+    const double SEGMENTS_PER_CELL = 4;
+    // and never more cells than this
+    const double MAX_GRID_CELLS = 1 << 22;
+
+    // coordKey units per degree
+    const double COORD_KEY_SCALE = 1e7;
+
+    // home slot of a coordKey, the same on every build and platform so saved
+    // tables stay valid
+    uint32_t homeSlot(uint64_t key, uint32_t slotMask)
+    {
+        return static_cast<uint32_t>(StreetGraph::coordHash(key)) & slotMask;
+    }
+}
+
+uint64_t StreetGraph::coordKey(double latitude, double longitude)
+{
+    //+-180 degrees is +-1.8e9 units, so each fits an int32; pack them two's complement
+    uint32_t lat = static_cast<uint32_t>(static_cast<int32_t>(llround(latitude * COORD_KEY_SCALE)));
+    uint32_t lon = static_cast<uint32_t>(static_cast<int32_t>(llround(longitude * COORD_KEY_SCALE)));
+    return (uint64_t(lat) << 32) | lon;
+}
+
+StreetGraph::StreetGraph()
+{
+    clear();
+}
+
+StreetGraph::~StreetGraph()
+{
+}
+
+void StreetGraph::clear()
+{
+    m_file.close();
+    vector<uint64_t>().swap(m_buffer);
+    m_image = nullptr;
+    m_imageSize = 0;
+    m_nodeCount = 0;
+    m_edgeCount = 0;
+    m_nameCount = 0;
+    m_slotMask = 0;
+    m_nodes = nullptr;
+    m_nodeText = nullptr;
+    m_offsets = nullptr;
+    m_edges = nullptr;
+    m_nameOffsets = nullptr;
+    m_nameText = nullptr;
+    m_slots = nullptr;
+    m_gridRows = 0;
+    m_gridCols = 0;
+    m_gridLat0 = 0;
+    m_gridLon0 = 0;
+    m_gridCellLat = 0;
+    m_gridCellLon = 0;
+    m_gridOffsets = nullptr;
+    m_gridEntries = nullptr;
+}
+
+GeoCoord StreetGraph::coord(uint32_t node) const
+{
+    //build the GeoCoord field by field, the text has already been parsed
+    const NodeRecord& rec = m_nodes[node];
+    GeoCoord gc;
+    gc.latitudeText.assign(m_nodeText + rec.textOffset, rec.latLength);
+    gc.longitudeText.assign(m_nodeText + rec.textOffset + rec.latLength, rec.lonLength);
+    gc.latitude = rec.latitude;
+    gc.longitude = rec.longitude;
+    return gc;
+}
+
+uint64_t StreetGraph::checksum() const
+{
+    if (m_image == nullptr)
+        return 0;
+    ImageHeader header;
+    memcpy(&header, m_image, sizeof(header));
+    return header.checksum;
+}
+
+uint32_t StreetGraph::findNode(uint64_t key) const
+{
+    if (m_nodeCount == 0)
+        return NO_NODE;
+
+    //probe from the key's home slot until its node or an empty slot turns up,
+    //never more than once round the table
+    uint32_t slot = homeSlot(key, m_slotMask);
+    for (uint64_t probes = 0; probes <= m_slotMask; probes++, slot = (slot + 1) & m_slotMask)
+    {
+        const NodeSlot& s = m_slots[slot];
+        if (s.node == NO_NODE || s.key == key)
+            return s.node;
+    }
+    return NO_NODE;
+}
+
+void StreetGraph::distancesFrom(uint32_t source, vector<double>& distance) const
+{
+    //every distance is wanted, so search straight into the caller's vector
+    Search search;
+    search.distance.swap(distance);
+    search.distance.assign(m_nodeCount, INFINITY);
+    dijkstra(source, search, 0);
+    distance.swap(search.distance);
+}
+
+void StreetGraph::distancesTo(uint32_t source, const vector<uint32_t>& targets, vector<double>& distance) const
+{
+    //one set of buffers per thread, grown to the largest graph searched
+    static thread_local Search search;
+    if (search.distance.size() < m_nodeCount)
+    {
+        search.distance.resize(m_nodeCount, INFINITY);
+        search.target.resize(m_nodeCount, false);
+    }
+
+    //mark each distinct target once, so repeated targets don't keep the search going
+    size_t targetCount = 0;
+    for (uint32_t node : targets)
+    {
+        if (!search.target[node])
+        {
+            search.target[node] = true;
+            targetCount++;
+        }
+    }
+    distance.assign(targets.size(), INFINITY);
+    if (targetCount == 0)
+        return;
+    dijkstra(source, search, targetCount);
+    for (size_t i = 0; i < targets.size(); i++)
+        distance[i] = search.distance[targets[i]];
+
+    //put back only what this search changed
+    for (uint32_t node : search.touched)
+        search.distance[node] = INFINITY;
+    for (uint32_t node : targets)
+        search.target[node] = false;
+}
+
+vector<uint32_t> StreetGraph::largestComponent() const
+{
+    vector<bool> seen(m_nodeCount, false);
+    vector<uint32_t> largest;
+    vector<uint32_t> component;
+    for (uint32_t root = 0; root < m_nodeCount; root++)
+    {
+        if (seen[root])
+            continue;
+        component.clear();
+        component.push_back(root);
+        seen[root] = true;
+        for (size_t i = 0; i < component.size(); i++)
+        {
+            for (const StreetEdge* e = edgesBegin(component[i]); e != edgesEnd(component[i]); e++)
+            {
+                if (!seen[e->to])
+                {
+                    seen[e->to] = true;
+                    component.push_back(e->to);
+                }
+            }
+        }
+        if (component.size() > largest.size())
+            largest.swap(component);
+    }
+    return largest;
+}
+
+//Dijkstra from source over search's buffers; with a targetCount, stop once that
+//many of the marked nodes are settled
+void StreetGraph::dijkstra(uint32_t source, Search& search, size_t targetCount) const
+{
+    typedef pair<double, uint32_t> Entry;
+    greater<Entry> later;
+    vector<double>& distance = search.distance;
+    vector<Entry>& open = search.open;
+    search.touched.clear();
+    open.clear();
+    distance[source] = 0;
+    search.touched.push_back(source);
+    open.push_back(Entry(0, source));
+    while (!open.empty())
+    {
+        pop_heap(open.begin(), open.end(), later);
+        Entry top = open.back();
+        open.pop_back();
+        //skip entries left behind by a later improvement
+        if (top.first > distance[top.second])
+            continue;
+        if (targetCount != 0 && search.target[top.second] && --targetCount == 0)
+            return;
+        for (const StreetEdge* e = edgesBegin(top.second); e != edgesEnd(top.second); e++)
+        {
+            double goal = top.first + e->length;
+            if (goal < distance[e->to])
+            {
+                if (distance[e->to] == INFINITY)
+                    search.touched.push_back(e->to);
+                distance[e->to] = goal;
+                open.push_back(Entry(goal, e->to));
+                push_heap(open.begin(), open.end(), later);
+            }
+        }
+    }
+}
+
+// Visit the segments listed in the grid cells around (lat, lon), nearest ring of
+// cells first.  Distances are measured in degrees of latitude on a plane scaled
+// for the query's latitude; visit updates best, the distance of the best find so
+// far, and the search ends once no unvisited cell can hold anything closer.
+template <typename Visit>
+void StreetGraph::searchGrid(double lat, double lon, const double& best, Visit visit) const
+{
+    double lonScale = cos(deg2rad(lat));
+    //the cell holding the point, or the nearest one if it is off the grid
+    long row = static_cast<long>(min<double>(m_gridRows - 1, max(0.0, floor((lat - m_gridLat0) / m_gridCellLat))));
+    long col = static_cast<long>(min<double>(m_gridCols - 1, max(0.0, floor((lon - m_gridLon0) / m_gridCellLon))));
+    double ringWidth = min(m_gridCellLat, m_gridCellLon * lonScale);
+    long rings = max(max(row, long(m_gridRows) - 1 - row), max(col, long(m_gridCols) - 1 - col));
+
+    for (long ring = 0; ring <= rings; ring++)
+    {
+        for (long r = row - ring; r <= row + ring; r++)
+        {
+            if (r < 0 || r >= long(m_gridRows))
+                continue;
+            //the whole row at the top and bottom of the ring, just the ends elsewhere
+            long step = (r == row - ring || r == row + ring) ? 1 : 2 * ring;
+            for (long c = col - ring; c <= col + ring; c += max(step, 1L))
+            {
+                if (c < 0 || c >= long(m_gridCols))
+                    continue;
+                size_t cell = size_t(r) * m_gridCols + c;
+                for (uint32_t i = m_gridOffsets[cell]; i < m_gridOffsets[cell + 1]; i++)
+                    visit(m_gridEntries[i].from, m_gridEntries[i].edge, lonScale);
+            }
+        }
+        //every cell beyond this ring is at least ring cells away
+        if (best <= ring * ringWidth)
+            break;
+    }
+}
+
+uint32_t StreetGraph::nearestNode(double lat, double lon) const
+{
+    if (m_nodeCount == 0)
+        return NO_NODE;
+    uint32_t nearest = NO_NODE;
+    double best = INFINITY;
+    auto consider = [&](uint32_t node, double lonScale) {
+        double dLat = m_nodes[node].latitude - lat;
+        double dLon = (m_nodes[node].longitude - lon) * lonScale;
+        double d = sqrt(dLat * dLat + dLon * dLon);
+        if (d < best || (d == best && node < nearest))
+        {
+            best = d;
+            nearest = node;
+        }
+    };
+    searchGrid(lat, lon, best, [&](uint32_t from, uint32_t edge, double lonScale) {
+        consider(from, lonScale);
+        consider(m_edges[edge].to, lonScale);
+    });
+    return nearest;
+}
+
+bool StreetGraph::nearestSegment(double lat, double lon, uint32_t& from, uint32_t& edge, double& t) const
+{
+    if (m_nodeCount == 0 || m_edgeCount == 0)
+        return false;
+    double best = INFINITY;
+    searchGrid(lat, lon, best, [&](uint32_t a, uint32_t e, double lonScale) {
+        //project the point onto the segment, clamped to its ends
+        uint32_t b = m_edges[e].to;
+        double abLat = m_nodes[b].latitude - m_nodes[a].latitude;
+        double abLon = (m_nodes[b].longitude - m_nodes[a].longitude) * lonScale;
+        double apLat = lat - m_nodes[a].latitude;
+        double apLon = (lon - m_nodes[a].longitude) * lonScale;
+        double lengthSquared = abLat * abLat + abLon * abLon;
+        double along = lengthSquared > 0 ? (apLat * abLat + apLon * abLon) / lengthSquared : 0;
+        along = min(1.0, max(0.0, along));
+        double dLat = apLat - along * abLat;
+        double dLon = apLon - along * abLon;
+        double d = sqrt(dLat * dLat + dLon * dLon);
+        if (d < best || (d == best && e < edge))
+        {
+            best = d;
+            from = a;
+            edge = e;
+            t = along;
+        }
+    });
+    return best != INFINITY;
+}
+
+void StreetGraph::build(const vector<GeoCoord>& coords, const vector<uint32_t>& offsets,
+                        const vector<StreetEdge>& edges, const vector<string>& names)
+{
+    //size every section
+    uint64_t nodeTextSize = 0;
+    for (const auto& gc : coords)
+        nodeTextSize += gc.latitudeText.size() + gc.longitudeText.size();
+    uint64_t nameTextSize = 0;
+    for (const auto& name : names)
+        nameTextSize += name.size() + 1;
+    //at most half full, so probe sequences stay short
+    uint32_t slotCount = 2;
+    while (slotCount < 2 * coords.size())
+        slotCount *= 2;
+
+    //lay a grid of roughly square (on the ground) cells over the nodes' bounding box
+    double minLat = 0, maxLat = 0, minLon = 0, maxLon = 0;
+    for (size_t i = 0; i < coords.size(); i++)
+    {
+        if (i == 0 || coords[i].latitude < minLat)  minLat = coords[i].latitude;
+        if (i == 0 || coords[i].latitude > maxLat)  maxLat = coords[i].latitude;
+        if (i == 0 || coords[i].longitude < minLon) minLon = coords[i].longitude;
+        if (i == 0 || coords[i].longitude > maxLon) maxLon = coords[i].longitude;
+    }
+    double lonScale = cos(deg2rad((minLat + maxLat) / 2));
+    double height = maxLat - minLat;
+    double width = (maxLon - minLon) * lonScale;
+    double cells = min(MAX_GRID_CELLS, max(1.0, edges.size() / 2 / SEGMENTS_PER_CELL));
+    double cellSide = height * width > 0 ? sqrt(height * width / cells) : max(height, width) / cells;
+    if (cellSide <= 0)
+        cellSide = 1;
+    double cellLat = cellSide;
+    double cellLon = cellSide / lonScale;
+    uint32_t gridRows = static_cast<uint32_t>(min(MAX_GRID_CELLS, max(1.0, ceil(height / cellLat))));
+    uint32_t gridCols = static_cast<uint32_t>(min(MAX_GRID_CELLS / gridRows, max(1.0, ceil((maxLon - minLon) / cellLon))));
+    auto rowOf = [&](double lat) {
+        return static_cast<uint32_t>(min<double>(gridRows - 1, max(0.0, floor((lat - minLat) / cellLat))));
+    };
+    auto colOf = [&](double lon) {
+        return static_cast<uint32_t>(min<double>(gridCols - 1, max(0.0, floor((lon - minLon) / cellLon))));
+    };
+
+    //list every segment in each cell its bounding box overlaps, counting first
+    vector<uint32_t> gridOffsets(size_t(gridRows) * gridCols + 1, 0);
+    vector<GridEntry> gridEntries;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (uint32_t from = 0; from + 1 < offsets.size(); from++)
+        {
+            for (uint32_t e = offsets[from]; e < offsets[from + 1]; e++)
+            {
+                uint32_t to = edges[e].to;
+                if (to < from)
+                    continue;
+                uint32_t row0 = rowOf(min(coords[from].latitude, coords[to].latitude));
+                uint32_t row1 = rowOf(max(coords[from].latitude, coords[to].latitude));
+                uint32_t col0 = colOf(min(coords[from].longitude, coords[to].longitude));
+                uint32_t col1 = colOf(max(coords[from].longitude, coords[to].longitude));
+                for (uint32_t row = row0; row <= row1; row++)
+                {
+                    for (uint32_t col = col0; col <= col1; col++)
+                    {
+                        size_t cell = size_t(row) * gridCols + col;
+                        if (pass == 0)
+                            gridOffsets[cell + 1]++;
+                        else
+                            gridEntries[gridOffsets[cell]++] = GridEntry{ from, e };
+                    }
+                }
+            }
+        }
+        if (pass == 0)
+        {
+            for (size_t cell = 0; cell + 1 < gridOffsets.size(); cell++)
+                gridOffsets[cell + 1] += gridOffsets[cell];
+            gridEntries.resize(gridOffsets.back());
+        }
+        else
+        {
+            //filling moved each offset to the end of its cell; shift them back
+            for (size_t cell = gridOffsets.size() - 1; cell > 0; cell--)
+                gridOffsets[cell] = gridOffsets[cell - 1];
+            gridOffsets[0] = 0;
+        }
+    }
+
+    ImageHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+    header.version = IMAGE_VERSION;
+    header.byteOrder = IMAGE_BYTE_ORDER;
+    header.nodeCount = static_cast<uint32_t>(coords.size());
+    header.edgeCount = static_cast<uint32_t>(edges.size());
+    header.nameCount = static_cast<uint32_t>(names.size());
+    header.slotCount = slotCount;
+    header.nodesAt = align8(sizeof(ImageHeader));
+    header.nodeTextAt = align8(header.nodesAt + coords.size() * sizeof(NodeRecord));
+    header.offsetsAt = align8(header.nodeTextAt + nodeTextSize);
+    header.edgesAt = align8(header.offsetsAt + offsets.size() * sizeof(uint32_t));
+    header.nameOffsetsAt = align8(header.edgesAt + edges.size() * sizeof(StreetEdge));
+    header.nameTextAt = align8(header.nameOffsetsAt + names.size() * sizeof(uint32_t));
+    header.slotsAt = align8(header.nameTextAt + nameTextSize);
+    header.gridRows = gridRows;
+    header.gridCols = gridCols;
+    header.gridLat0 = minLat;
+    header.gridLon0 = minLon;
+    header.gridCellLat = cellLat;
+    header.gridCellLon = cellLon;
+    header.gridOffsetsAt = align8(header.slotsAt + uint64_t(slotCount) * sizeof(NodeSlot));
+    header.gridEntriesAt = align8(header.gridOffsetsAt + gridOffsets.size() * sizeof(uint32_t));
+    header.imageSize = align8(header.gridEntriesAt + gridEntries.size() * sizeof(GridEntry));
+
+    //fill a fresh zeroed buffer
+    vector<uint64_t> buffer(header.imageSize / 8, 0);
+    char* image = reinterpret_cast<char*>(buffer.data());
+
+    NodeRecord* nodes = reinterpret_cast<NodeRecord*>(image + header.nodesAt);
+    char* nodeText = image + header.nodeTextAt;
+    uint32_t textOffset = 0;
+    for (size_t i = 0; i < coords.size(); i++)
+    {
+        const GeoCoord& gc = coords[i];
+        nodes[i].latitude = gc.latitude;
+        nodes[i].longitude = gc.longitude;
+        nodes[i].textOffset = textOffset;
+        nodes[i].latLength = static_cast<uint16_t>(gc.latitudeText.size());
+        nodes[i].lonLength = static_cast<uint16_t>(gc.longitudeText.size());
+        memcpy(nodeText + textOffset, gc.latitudeText.data(), gc.latitudeText.size());
+        textOffset += nodes[i].latLength;
+        memcpy(nodeText + textOffset, gc.longitudeText.data(), gc.longitudeText.size());
+        textOffset += nodes[i].lonLength;
+    }
+
+    if (!offsets.empty())
+        memcpy(image + header.offsetsAt, offsets.data(), offsets.size() * sizeof(uint32_t));
+    if (!edges.empty())
+        memcpy(image + header.edgesAt, edges.data(), edges.size() * sizeof(StreetEdge));
+
+    uint32_t* nameOffsets = reinterpret_cast<uint32_t*>(image + header.nameOffsetsAt);
+    char* nameText = image + header.nameTextAt;
+    uint32_t nameOffset = 0;
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        nameOffsets[i] = nameOffset;
+        memcpy(nameText + nameOffset, names[i].c_str(), names[i].size() + 1);
+        nameOffset += static_cast<uint32_t>(names[i].size() + 1);
+    }
+
+    NodeSlot* slots = reinterpret_cast<NodeSlot*>(image + header.slotsAt);
+    for (uint32_t i = 0; i < slotCount; i++)
+        slots[i].node = NO_NODE;
+    for (uint32_t node = 0; node < header.nodeCount; node++)
+    {
+        uint64_t key = coordKey(coords[node]);
+        uint32_t slot = homeSlot(key, slotCount - 1);
+        while (slots[slot].node != NO_NODE)
+            slot = (slot + 1) & (slotCount - 1);
+        slots[slot].key = key;
+        slots[slot].node = node;
+    }
+
+    memcpy(image + header.gridOffsetsAt, gridOffsets.data(), gridOffsets.size() * sizeof(uint32_t));
+    if (!gridEntries.empty())
+        memcpy(image + header.gridEntriesAt, gridEntries.data(), gridEntries.size() * sizeof(GridEntry));
+
+    header.checksum = checksumWords(image + sizeof(ImageHeader), header.imageSize - sizeof(ImageHeader));
+    memcpy(image, &header, sizeof(header));
+
+    //swap in the new image
+    clear();
+    m_buffer.swap(buffer);
+    attach(reinterpret_cast<const char*>(m_buffer.data()), m_buffer.size() * 8);
+}
+
+bool StreetGraph::attach(const char* image, size_t size)
+{
+    //check the header describes an image that fits in size bytes before trusting any of it
+    if (size < sizeof(ImageHeader))
+        return false;
+    ImageHeader header;
+    memcpy(&header, image, sizeof(header));
+    if (memcmp(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0 ||
+        header.version != IMAGE_VERSION || header.byteOrder != IMAGE_BYTE_ORDER ||
+        header.imageSize != size)
+        return false;
+    if (header.slotCount == 0 || (header.slotCount & (header.slotCount - 1)) != 0)
+        return false;
+    if (header.gridRows == 0 || header.gridCols == 0 || !(header.gridCellLat > 0) || !(header.gridCellLon > 0))
+        return false;
+    const uint64_t sections[] = { header.nodesAt, header.nodeTextAt, header.offsetsAt, header.edgesAt,
+                                  header.nameOffsetsAt, header.nameTextAt, header.slotsAt,
+                                  header.gridOffsetsAt, header.gridEntriesAt, header.imageSize };
+    for (size_t i = 0; i + 1 < sizeof(sections) / sizeof(sections[0]); i++)
+        if (sections[i] % 8 != 0 || sections[i] > sections[i + 1])
+            return false;
+    if (header.offsetsAt - header.nodesAt < uint64_t(header.nodeCount) * sizeof(NodeRecord) ||
+        header.edgesAt - header.offsetsAt < (uint64_t(header.nodeCount) + 1) * sizeof(uint32_t) ||
+        header.nameOffsetsAt - header.edgesAt < uint64_t(header.edgeCount) * sizeof(StreetEdge) ||
+        header.nameTextAt - header.nameOffsetsAt < uint64_t(header.nameCount) * sizeof(uint32_t) ||
+        header.gridOffsetsAt - header.slotsAt < uint64_t(header.slotCount) * sizeof(NodeSlot) ||
+        header.gridEntriesAt - header.gridOffsetsAt < (uint64_t(header.gridRows) * header.gridCols + 1) * sizeof(uint32_t))
+        return false;
+    const uint32_t* gridOffsets = reinterpret_cast<const uint32_t*>(image + header.gridOffsetsAt);
+    if (header.imageSize - header.gridEntriesAt < uint64_t(gridOffsets[uint64_t(header.gridRows) * header.gridCols]) * sizeof(GridEntry))
+        return false;
+
+    m_image = image;
+    m_imageSize = size;
+    m_nodeCount = header.nodeCount;
+    m_edgeCount = header.edgeCount;
+    m_nameCount = header.nameCount;
+    m_slotMask = header.slotCount - 1;
+    m_nodes = reinterpret_cast<const NodeRecord*>(image + header.nodesAt);
+    m_nodeText = image + header.nodeTextAt;
+    m_offsets = reinterpret_cast<const uint32_t*>(image + header.offsetsAt);
+    m_edges = reinterpret_cast<const StreetEdge*>(image + header.edgesAt);
+    m_nameOffsets = reinterpret_cast<const uint32_t*>(image + header.nameOffsetsAt);
+    m_nameText = image + header.nameTextAt;
+    m_slots = reinterpret_cast<const NodeSlot*>(image + header.slotsAt);
+    m_gridRows = header.gridRows;
+    m_gridCols = header.gridCols;
+    m_gridLat0 = header.gridLat0;
+    m_gridLon0 = header.gridLon0;
+    m_gridCellLat = header.gridCellLat;
+    m_gridCellLon = header.gridCellLon;
+    m_gridOffsets = gridOffsets;
+    m_gridEntries = reinterpret_cast<const GridEntry*>(image + header.gridEntriesAt);
+    return true;
+}
+
+bool StreetGraph::validate() const
+{
+    //every index the searches follow without checking must be in range; the
+    //sections themselves were checked to fit by attach
+    const ImageHeader& header = *reinterpret_cast<const ImageHeader*>(m_image);
+    uint64_t nodeTextSize = header.offsetsAt - header.nodeTextAt;
+    uint64_t nameTextSize = header.slotsAt - header.nameTextAt;
+    uint64_t gridEntryCount = (header.imageSize - header.gridEntriesAt) / sizeof(GridEntry);
+    for (uint32_t node = 0; node < m_nodeCount; node++)
+    {
+        const NodeRecord& record = m_nodes[node];
+        if (uint64_t(record.textOffset) + record.latLength + record.lonLength > nodeTextSize)
+            return false;
+    }
+    if (m_offsets[0] != 0 || m_offsets[m_nodeCount] != m_edgeCount)
+        return false;
+    for (uint32_t node = 0; node < m_nodeCount; node++)
+        if (m_offsets[node] > m_offsets[node + 1])
+            return false;
+    for (uint32_t e = 0; e < m_edgeCount; e++)
+        if (m_edges[e].to >= m_nodeCount || m_edges[e].nameId >= m_nameCount)
+            return false;
+    //names are read up to their NUL, so one has to come after the last name starts
+    uint64_t lastName = 0;
+    for (uint32_t name = 0; name < m_nameCount; name++)
+        lastName = max<uint64_t>(lastName, m_nameOffsets[name]);
+    if (m_nameCount > 0 && (lastName >= nameTextSize ||
+                            memchr(m_nameText + lastName, '\0', nameTextSize - lastName) == nullptr))
+        return false;
+    //findNode probes until it meets its key or an empty slot, so keys must match
+    //their nodes and at least one slot must be empty
+    bool anyEmpty = false;
+    for (uint32_t slot = 0; slot <= m_slotMask; slot++)
+    {
+        const NodeSlot& s = m_slots[slot];
+        if (s.node == NO_NODE)
+            anyEmpty = true;
+        else if (s.node >= m_nodeCount || s.key != coordKey(m_nodes[s.node].latitude, m_nodes[s.node].longitude))
+            return false;
+    }
+    if (!anyEmpty)
+        return false;
+    uint64_t cells = uint64_t(m_gridRows) * m_gridCols;
+    if (m_gridOffsets[0] != 0 || m_gridOffsets[cells] > gridEntryCount)
+        return false;
+    for (uint64_t cell = 0; cell < cells; cell++)
+        if (m_gridOffsets[cell] > m_gridOffsets[cell + 1])
+            return false;
+    for (uint32_t i = 0; i < m_gridOffsets[cells]; i++)
+    {
+        const GridEntry& entry = m_gridEntries[i];
+        if (entry.from >= m_nodeCount || entry.edge < m_offsets[entry.from] || entry.edge >= m_offsets[entry.from + 1])
+            return false;
+    }
+    return true;
+}
+
+bool StreetGraph::save(const string& file) const
+{
+    if (m_image == nullptr)
+        return false;
+    ofstream outf(file, ios::binary | ios::trunc);
+    if (!outf)
+        return false;
+    outf.write(m_image, m_imageSize);
+    return static_cast<bool>(outf);
+}
+
+bool StreetGraph::load(const string& file)
+{
+    MappedFile snapshot;
+    if (!snapshot.open(file))
+        return false;
+    const char* image = snapshot.data();
+    size_t size = snapshot.size();
+
+    //reject truncated, foreign or corrupted files, keeping the current graph
+    if (size < sizeof(ImageHeader))
+        return false;
+    ImageHeader header;
+    memcpy(&header, image, sizeof(header));
+    if (header.imageSize != size ||
+        checksumWords(image + sizeof(ImageHeader), size - sizeof(ImageHeader)) != header.checksum)
+        return false;
+    StreetGraph check;
+    if (!check.attach(image, size) || !check.validate())
+        return false;
+
+    //take over the validated image
+    clear();
+    m_file.swap(snapshot);
+    return attach(m_file.data(), m_file.size());
+}
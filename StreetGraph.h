@@ -0,0 +1,204 @@
+#ifndef STREETGRAPH_INCLUDED
+#define STREETGRAPH_INCLUDED
+
+#include "provided.h"
+#include "MappedFile.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+// One step of a route through the graph.  edge is the edge from -> to, or the
+// matching edge to -> from when the step was found by searching backwards;
+// either way it carries the street's name and length.
+struct RouteStep
+{
+    uint32_t from;
+    uint32_t to;
+    uint32_t edge;
+};
+
+// Compact (compressed sparse row) form of the street map built by StreetMap::load.
+// Nodes are numbered 0..nodeCount()-1 in the order they first appear in the map file.
+// The outgoing edges of node u are stored contiguously, in file order, from
+// edgesBegin(u) up to edgesEnd(u), so searches can walk them without hashing.
+// GeoCoords are only needed to turn a coordinate into a node id (findNode)
+// and a node id back into a coordinate (coord) at the API boundary.  A node is
+// identified by its coordKey, a fixed point latitude and longitude packed into
+// 64 bits, so finding one hashes and compares integers, never text; the text is
+// kept only so coord can hand back the GeoCoord the map file gave.  A uniform
+// grid over the segments finds the nearest node or segment to any other point.
+//
+// All of the graph lives in one flat image (see StreetGraph.cpp for the layout).
+// A freshly built graph keeps its image on the heap; a graph loaded from a
+// snapshot file uses the file's memory mapping directly, with no parsing and
+// no per-node allocation.
+class StreetGraph
+{
+public:
+    static const uint32_t NO_NODE = 0xFFFFFFFF;
+
+    StreetGraph();
+    ~StreetGraph();
+
+    uint32_t nodeCount() const { return m_nodeCount; }
+    uint32_t edgeCount() const { return m_edgeCount; }
+    uint32_t nameCount() const { return m_nameCount; }
+    size_t imageSize() const { return m_imageSize; }
+
+    const StreetEdge* edgesBegin(uint32_t node) const { return m_edges + m_offsets[node]; }
+    const StreetEdge* edgesEnd(uint32_t node) const { return m_edges + m_offsets[node + 1]; }
+    StreetEdgeRange edges(uint32_t node) const { return StreetEdgeRange(edgesBegin(node), edgesEnd(node)); }
+    const StreetEdge& edge(uint32_t index) const { return m_edges[index]; }
+    uint32_t edgeIndex(const StreetEdge* e) const { return static_cast<uint32_t>(e - m_edges); }
+
+    double latitude(uint32_t node) const { return m_nodes[node].latitude; }
+    double longitude(uint32_t node) const { return m_nodes[node].longitude; }
+    GeoCoord coord(uint32_t node) const;
+
+    // straight line distance between two nodes, or a node and a coordinate
+    double distanceMiles(uint32_t a, uint32_t b) const
+    {
+        return distanceEarthMiles(m_nodes[a].latitude, m_nodes[a].longitude, m_nodes[b].latitude, m_nodes[b].longitude);
+    }
+    double distanceMiles(uint32_t a, const GeoCoord& gc) const
+    {
+        return distanceEarthMiles(m_nodes[a].latitude, m_nodes[a].longitude, gc.latitude, gc.longitude);
+    }
+
+    // street names are stored NUL-terminated, so nameText can be used as a C string
+    const char* nameText(uint32_t nameId) const { return m_nameText + m_nameOffsets[nameId]; }
+    std::string name(uint32_t nameId) const { return nameText(nameId); }
+
+    // returns the id of the node at gc / with this key, or NO_NODE if no segment starts there
+    uint32_t findNode(const GeoCoord& gc) const { return findNode(coordKey(gc)); }
+    uint32_t findNode(uint64_t key) const;
+
+    // the node nearest to (lat, lon), or NO_NODE if the graph is empty
+    uint32_t nearestNode(double lat, double lon) const;
+    // the point on any segment nearest to (lat, lon): fraction t of the way along edge,
+    // which leaves node from; false if the graph has no segments
+    bool nearestSegment(double lat, double lon, uint32_t& from, uint32_t& edge, double& t) const;
+
+    // latitude and longitude each rounded to a whole number of 1e-7 degrees (the
+    // precision of the map files, about a centimetre) and packed as two 32 bit
+    // halves, latitude high; coordinates with the same key are the same node
+    static uint64_t coordKey(double latitude, double longitude);
+    static uint64_t coordKey(const GeoCoord& gc) { return coordKey(gc.latitude, gc.longitude); }
+    // hash of a coordKey with every bit mixed (the MurmurHash3 finalizer); on a
+    // lattice the two halves of nearby keys differ only in their low bits, so the
+    // key itself, or its halves xored together, collide badly
+    static uint64_t coordHash(uint64_t key)
+    {
+        key = (key ^ (key >> 33)) * 0xFF51AFD7ED558CCDull;
+        key = (key ^ (key >> 33)) * 0xC4CEB9FE1A85EC53ull;
+        return key ^ (key >> 33);
+    }
+
+    // road distances from source to every node (Dijkstra), INFINITY where there is no route
+    void distancesFrom(uint32_t source, std::vector<double>& distance) const;
+    // the same, but only to targets (distance[i] is for targets[i]); the search stops
+    // as soon as every target is settled, so nearby targets are cheap
+    void distancesTo(uint32_t source, const std::vector<uint32_t>& targets, std::vector<double>& distance) const;
+    // the nodes of the largest connected part of the graph, in the order a breadth
+    // first search reaches them
+    std::vector<uint32_t> largestComponent() const;
+
+    // rebuild the StreetSegment for edge e leaving node from, or for a route step
+    StreetSegment segment(uint32_t from, const StreetEdge& e) const
+    {
+        return StreetSegment(coord(from), coord(e.to), name(e.nameId));
+    }
+    StreetSegment segment(const RouteStep& step) const
+    {
+        return StreetSegment(coord(step.from), coord(step.to), name(m_edges[step.edge].nameId));
+    }
+
+    // replace the graph with one built from CSR arrays; offsets has coords.size()+1 entries
+    void build(const std::vector<GeoCoord>& coords, const std::vector<uint32_t>& offsets,
+               const std::vector<StreetEdge>& edges, const std::vector<std::string>& names);
+    void clear();
+
+    // write the image to a snapshot file / map a snapshot file in place of the current
+    // graph, once its checksum and every node, edge, name and grid index in it check out
+    bool save(const std::string& file) const;
+    bool load(const std::string& file);
+
+    // checksum of the image, identifying this exact graph (0 if empty)
+    uint64_t checksum() const;
+
+    // C++11 syntax for preventing copying and assignment
+    StreetGraph(const StreetGraph&) = delete;
+    StreetGraph& operator=(const StreetGraph&) = delete;
+
+private:
+    struct NodeRecord
+    {
+        double   latitude;
+        double   longitude;
+        uint32_t textOffset;  // latitude text then longitude text, in m_nodeText
+        uint16_t latLength;
+        uint16_t lonLength;
+    };
+
+    struct NodeSlot
+    {
+        uint64_t key;
+        uint32_t node;      // NO_NODE for an empty slot
+        uint32_t unused;
+    };
+
+    struct GridEntry
+    {
+        uint32_t from;
+        uint32_t edge;
+    };
+
+    // Buffers for one Dijkstra, kept between searches so a search costs only the
+    // nodes it reaches.  Between searches every distance is INFINITY and no node
+    // is a target; the search lists the nodes it reaches in touched for resetting.
+    struct Search
+    {
+        std::vector<double> distance;
+        std::vector<bool> target;
+        std::vector<uint32_t> touched;
+        std::vector<std::pair<double, uint32_t>> open;    // heap, nearest first
+    };
+
+    // image storage: either the heap buffer or a snapshot file
+    std::vector<uint64_t> m_buffer;
+    MappedFile m_file;
+
+    // views into the image
+    const char* m_image;
+    size_t   m_imageSize;
+    uint32_t m_nodeCount;
+    uint32_t m_edgeCount;
+    uint32_t m_nameCount;
+    uint32_t m_slotMask;
+    const NodeRecord* m_nodes;
+    const char*       m_nodeText;
+    const uint32_t*   m_offsets;
+    const StreetEdge* m_edges;
+    const uint32_t*   m_nameOffsets;
+    const char*       m_nameText;
+    const NodeSlot*   m_slots;      // open addressed table of node ids by coordKey
+    uint32_t m_gridRows;
+    uint32_t m_gridCols;
+    double   m_gridLat0;
+    double   m_gridLon0;
+    double   m_gridCellLat;
+    double   m_gridCellLon;
+    const uint32_t*   m_gridOffsets;  // segments near each cell of the spatial grid
+    const GridEntry*  m_gridEntries;
+
+    bool attach(const char* image, size_t size);
+    bool validate() const;
+    void dijkstra(uint32_t source, Search& search, size_t targetCount) const;
+    template <typename Visit>
+    void searchGrid(double lat, double lon, const double& best, Visit visit) const;
+};
+
+#endif // STREETGRAPH_INCLUDED
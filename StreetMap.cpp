@@ -1,17 +1,24 @@
 #include "provided.h"
-#include "ExpandableHashMap.h"
+#include "FlatHashMap.h"
+#include "StreetGraph.h"
+#include "ContractionHierarchy.h"
+#include "LandmarkIndex.h"
+#include "MappedFile.h"
 
 #include <string>
 #include <vector>
 #include <functional>
-#include <iostream>
-#include <fstream>
-#include <sstream>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
 using namespace std;
 
 unsigned int hasher(const GeoCoord& g)
 {
-    return std::hash<string>()(g.latitudeText + g.longitudeText);
+    return static_cast<unsigned int>(StreetGraph::coordHash(StreetGraph::coordKey(g)));
 }
 
 class StreetMapImpl
@@ -19,12 +26,292 @@ class StreetMapImpl
 public:
     StreetMapImpl();
     ~StreetMapImpl();
-    bool load(string mapFile);
+    bool load(string mapFile, PlannerStats* stats);
     bool getSegmentsThatStartWith(const GeoCoord& gc, vector<StreetSegment>& segs) const;
+    bool contains(const GeoCoord& gc) const;
+    StreetEdgeRange edgesFrom(const GeoCoord& gc) const;
+    bool snapToNetwork(const GeoCoord& gc, GeoCoord& node) const;
+    bool snapToSegment(const GeoCoord& gc, StreetSegment& segment, GeoCoord& point) const;
+    bool saveSnapshot(string snapshotFile) const;
+    bool loadSnapshot(string snapshotFile);
+    const StreetGraph& graph() const { return m_graph; }
+    void buildHierarchy();
+    bool saveHierarchy(string hierarchyFile) const;
+    bool loadHierarchy(string hierarchyFile);
+    const ContractionHierarchy& hierarchy() const { return m_hierarchy; }
+    void buildLandmarks(int count);
+    const LandmarkIndex& landmarks() const { return m_landmarks; }
 private:
-    ExpandableHashMap<GeoCoord, vector<StreetSegment>> m_map;
+    StreetGraph m_graph;
+    ContractionHierarchy m_hierarchy;   //empty unless built or loaded for m_graph
+    LandmarkIndex m_landmarks;          //empty unless built for m_graph
 };
 
+//******************** map file parsing ***************************************
+
+// The map file is scanned in place (memory mapped), without building a string per line.
+// Large files are cut into chunks at street name lines, each chunk is parsed on its own
+// thread, and the chunks are merged in file order, so the graph is identical to the one
+// a single line-by-line pass produces.
+
+namespace
+{
+    //don't bother starting a thread for less text than this
+    const size_t MIN_CHUNK_BYTES = 1 << 20;
+    //rough size of the text per distinct coordinate, for sizing node tables up front
+    const size_t BYTES_PER_NODE = 64;
+
+    //a coordinate's text as written in the map file, pointing into the file text
+    struct CoordText
+    {
+        const char* lat;
+        const char* lon;
+        uint16_t latLength;
+        uint16_t lonLength;
+    };
+
+    //a street name as written in the map file, pointing into the file text
+    struct NameText
+    {
+        const char* text;
+        size_t length;
+        uint64_t hash;
+    };
+
+    bool operator==(const NameText& lhs, const NameText& rhs)
+    {
+        return lhs.hash == rhs.hash && lhs.length == rhs.length && memcmp(lhs.text, rhs.text, lhs.length) == 0;
+    }
+
+    //FNV-1a
+    uint64_t hashName(const char* text, size_t length)
+    {
+        uint64_t h = 14695981039346656037ull;
+        for (size_t i = 0; i < length; i++)
+            h = (h ^ static_cast<unsigned char>(text[i])) * 1099511628211ull;
+        return h;
+    }
+
+    struct ParsedNode
+    {
+        CoordText text;
+        double latitude;
+        double longitude;
+        uint64_t key;       //StreetGraph::coordKey, which is what identifies the node
+    };
+
+    //a coordKey as a hash table key, hashed with StreetGraph::coordHash
+    struct NodeKey
+    {
+        uint64_t key;
+    };
+
+    bool operator==(const NodeKey& lhs, const NodeKey& rhs)
+    {
+        return lhs.key == rhs.key;
+    }
+
+    //a segment in terms of its chunk's node and name numbering
+    struct ParsedSegment
+    {
+        uint32_t start;
+        uint32_t end;
+        uint32_t nameId;
+        double   length;
+    };
+
+    struct ParsedChunk
+    {
+        vector<ParsedNode> nodes;      //in order of first appearance in the chunk
+        vector<ParsedSegment> segments;
+        vector<pair<const char*, size_t>> names;
+    };
+}
+
+unsigned int hasher(const NameText& t)
+{
+    return static_cast<unsigned int>(t.hash);
+}
+
+unsigned int hasher(const NodeKey& k)
+{
+    return static_cast<unsigned int>(StreetGraph::coordHash(k.key));
+}
+
+namespace
+{
+    //coordinate key to its index in a node list
+    typedef FlatHashMap<NodeKey, uint32_t> NodeTable;
+
+    //return the index of the node with n's key, appending n to nodes if there is none
+    uint32_t findOrAddNode(NodeTable& table, vector<ParsedNode>& nodes, const ParsedNode& n)
+    {
+        pair<uint32_t*, bool> result = table.try_emplace(NodeKey{ n.key }, static_cast<uint32_t>(nodes.size()));
+        if (result.second)
+            nodes.push_back(n);
+        return *result.first;
+    }
+
+    //the characters operator>> treats as separators
+    inline bool isBlank(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    inline bool isDigit(char c)
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    //split a line into whitespace separated tokens, stopping after the fifth
+    int tokenize(const char* p, const char* end, const char* tok[5], size_t len[5])
+    {
+        int count = 0;
+        while (count < 5)
+        {
+            while (p != end && isBlank(*p))
+                p++;
+            if (p == end)
+                break;
+            tok[count] = p;
+            while (p != end && !isBlank(*p))
+                p++;
+            len[count] = p - tok[count];
+            count++;
+        }
+        return count;
+    }
+
+    //a segment line is exactly four tokens and starts with a digit; any other line
+    //longer than three characters names the street whose segments follow
+    inline bool isSegmentLine(const char* line, const char* end, const char* tok[5], size_t len[5])
+    {
+        return line != end && isDigit(*line) && tokenize(line, end, tok, len) == 4;
+    }
+
+    inline bool isNameLine(const char* line, const char* end)
+    {
+        const char* tok[5];
+        size_t len[5];
+        return end - line > 3 && !isSegmentLine(line, end, tok, len);
+    }
+
+    //decimal text to the same double std::stod gives.  Plain decimals of up to 15 digits
+    //are exact as an integer over a power of ten no larger than 1e22, and one correctly
+    //rounded division of two exact doubles is what strtod returns.  Anything else goes
+    //to strtod itself.
+    double parseCoordinate(const char* s, size_t n)
+    {
+        static const double POWERS_OF_TEN[] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+
+        size_t i = 0;
+        bool negative = false;
+        if (i < n && (s[i] == '-' || s[i] == '+'))
+            negative = s[i++] == '-';
+        uint64_t mantissa = 0;
+        int digits = 0;
+        int fractionDigits = 0;
+        for (; i < n && isDigit(s[i]); i++, digits++)
+            mantissa = mantissa * 10 + (s[i] - '0');
+        if (i < n && s[i] == '.')
+            for (i++; i < n && isDigit(s[i]); i++, digits++, fractionDigits++)
+                mantissa = mantissa * 10 + (s[i] - '0');
+
+        if (i == n && digits > 0 && digits <= 15 && fractionDigits <= 22)
+        {
+            double value = static_cast<double>(mantissa) / POWERS_OF_TEN[fractionDigits];
+            return negative ? -value : value;
+        }
+
+        char buffer[64];
+        if (n < sizeof(buffer))
+        {
+            memcpy(buffer, s, n);
+            buffer[n] = '\0';
+            return strtod(buffer, nullptr);
+        }
+        return strtod(string(s, n).c_str(), nullptr);
+    }
+
+    //start of the line after the one containing p
+    const char* nextLine(const char* p, const char* end)
+    {
+        const char* newline = static_cast<const char*>(memchr(p, '\n', end - p));
+        return newline == nullptr ? end : newline + 1;
+    }
+
+    //the first street name line at or after the line following p
+    const char* chunkStart(const char* p, const char* end)
+    {
+        for (p = nextLine(p, end); p != end; p = nextLine(p, end))
+        {
+            const char* lineEnd = static_cast<const char*>(memchr(p, '\n', end - p));
+            if (isNameLine(p, lineEnd == nullptr ? end : lineEnd))
+                return p;
+        }
+        return end;
+    }
+
+    void parseChunk(const char* begin, const char* end, ParsedChunk& out)
+    {
+        NodeTable table;
+        table.reserve(static_cast<int>((end - begin) / BYTES_PER_NODE));
+
+        const char* streetName = "";
+        size_t streetNameLength = 0;
+        bool newStreet = true;
+
+        const char* tok[5];
+        size_t len[5];
+        for (const char* line = begin; line != end; )
+        {
+            const char* lineEnd = static_cast<const char*>(memchr(line, '\n', end - line));
+            if (lineEnd == nullptr)
+                lineEnd = end;
+
+            if (isSegmentLine(line, lineEnd, tok, len))
+            {
+                if (newStreet)
+                {
+                    out.names.push_back(make_pair(streetName, streetNameLength));
+                    newStreet = false;
+                }
+
+                ParsedNode n[2];
+                for (int i = 0; i < 2; i++)
+                {
+                    CoordText& t = n[i].text;
+                    t.lat = tok[2 * i];
+                    t.lon = tok[2 * i + 1];
+                    t.latLength = static_cast<uint16_t>(len[2 * i]);
+                    t.lonLength = static_cast<uint16_t>(len[2 * i + 1]);
+                    n[i].latitude = parseCoordinate(t.lat, t.latLength);
+                    n[i].longitude = parseCoordinate(t.lon, t.lonLength);
+                    n[i].key = StreetGraph::coordKey(n[i].latitude, n[i].longitude);
+                }
+
+                ParsedSegment seg;
+                seg.start = findOrAddNode(table, out.nodes, n[0]);
+                seg.end = findOrAddNode(table, out.nodes, n[1]);
+                seg.nameId = static_cast<uint32_t>(out.names.size() - 1);
+                seg.length = distanceEarthMiles(n[0].latitude, n[0].longitude, n[1].latitude, n[1].longitude);
+                out.segments.push_back(seg);
+            }
+            else if (lineEnd - line > 3)
+            {
+                streetName = line;
+                streetNameLength = lineEnd - line;
+                newStreet = true;
+            }
+
+            line = lineEnd == end ? end : lineEnd + 1;
+        }
+    }
+}
+
 StreetMapImpl::StreetMapImpl()
 {
 
@@ -34,114 +321,215 @@ StreetMapImpl::~StreetMapImpl()
 {
 }
 
-bool StreetMapImpl::load(string mapFile)
+bool StreetMapImpl::load(string mapFile, PlannerStats* stats)
 {
-	ifstream inf(mapFile);   
+	chrono::steady_clock::time_point started = chrono::steady_clock::now();
+	MappedFile file;
+	if (!file.open(mapFile)) // Did opening the file fail?
+		return false;
+	const char* text = file.data();
+	const char* textEnd = text + file.size();
 
-	if (!inf) // Did opening the file fail?
+	//cut the text into chunks that each start with a street name line
+	size_t threads = thread::hardware_concurrency();
+	threads = max<size_t>(1, min(threads, file.size() / MIN_CHUNK_BYTES));
+	vector<const char*> bounds(1, text);
+	for (size_t i = 1; i < threads; i++)
 	{
-		return false;
+		const char* p = chunkStart(max(bounds.back(), text + file.size() * i / threads), textEnd);
+		if (p != textEnd)
+			bounds.push_back(p);
 	}
-	else
+	bounds.push_back(textEnd);
+
+	//parse the chunks side by side
+	vector<ParsedChunk> chunks(bounds.size() - 1);
+	vector<thread> workers;
+	for (size_t i = 1; i < chunks.size(); i++)
+		workers.push_back(thread(parseChunk, bounds[i], bounds[i + 1], ref(chunks[i])));
+	parseChunk(bounds[0], bounds[1], chunks[0]);
+	for (auto& w : workers)
+		w.join();
+
+	//merge in file order: nodes are numbered by first appearance in the file,
+	//and each chunk's nodes are already in first appearance order; a name used by
+	//many streets (every "Main Street" of a county) is stored just once
+	NodeTable table;
+	table.reserve(static_cast<int>(file.size() / BYTES_PER_NODE));
+	vector<ParsedNode> nodes;
+	vector<vector<uint32_t>> nodeIds(chunks.size());
+	FlatHashMap<NameText, uint32_t> nameTable;
+	vector<vector<uint32_t>> nameIds(chunks.size());
+	vector<string> names;
+	for (size_t c = 0; c < chunks.size(); c++)
 	{
-		string streetName;
-		// Read each line.  The return value of getline is treated
-		// as true if a line was read, false otherwise (e.g., because
-		// the end of the file was reached).
-		string line;
-		while (getline(inf, line))
+		for (const auto& n : chunks[c].nodes)
+			nodeIds[c].push_back(findOrAddNode(table, nodes, n));
+		for (const auto& name : chunks[c].names)
 		{
-			// To extract the information from the line, we'll
-			// create an input stringstream from it, which acts
-			// like a source of input for operator >>
-			istringstream iss(line);
-
-			//geocoord lat/longs
-			string lat1;
-			string long1;
-			string lat2;
-			string long2;
-			string dummy;
-
-			//if segment
-			if (iss >> lat1 >> long1 >> lat2 >> long2 && !(iss >> dummy) && isdigit(line[0]))
-			{
-				
-				string lat1s = lat1;
-				string long1s = long1;
-				string lat2s = lat2;
-				string long2s = long2;
-
-				auto startCoord = GeoCoord(lat1s, long1s);
-				auto endCoord = GeoCoord(lat2s, long2s);
-
-				auto segment = StreetSegment(startCoord, endCoord, streetName);
-				//check if this key is already mapped
-				auto segVectPointer = m_map.find(startCoord);
-				//if mapped, then add to the existing vector
-				if (segVectPointer != nullptr)
-				{
-					(*segVectPointer).push_back(segment);
-					m_map.associate(startCoord, *segVectPointer);
-				}
-				//if not mapped, created a vector and map it
-				else
-				{
-					vector<StreetSegment> temp;
-					temp.push_back(segment);
-					m_map.associate(startCoord, temp);
-				}
-
-				//swap start/end coords in segment
-				segment = StreetSegment(endCoord, startCoord, streetName);
-				//check if this key is already mapped
-				segVectPointer = m_map.find(endCoord);
-				//if mapped, then add to the existing vector
-				if (segVectPointer != nullptr)
-				{
-					(*segVectPointer).push_back(segment);
-					m_map.associate(endCoord, *segVectPointer);
-				}
-				//if not mapped, created a vector and map it
-				else
-				{
-					vector<StreetSegment> temp;
-					temp.push_back(segment);
-					m_map.associate(endCoord, temp);
-				}
-			}
-			else
-			{
-				bool proceed = true;
-				if (line.size() <= 3)
-					proceed = false;
-
-				//if street name
-				if (proceed)
-				{
-					streetName = line;
-				}
-
-			}
+			NameText key = { name.first, name.second, hashName(name.first, name.second) };
+			pair<uint32_t*, bool> result = nameTable.try_emplace(key, static_cast<uint32_t>(names.size()));
+			if (result.second)
+				names.push_back(string(name.first, name.second));
+			nameIds[c].push_back(*result.first);
 		}
 	}
+
+	//counting sort of both directions of every segment by start node,
+	//filled in file order so each node keeps its edges in file order
+	vector<uint32_t> offsets(nodes.size() + 1, 0);
+	for (size_t c = 0; c < chunks.size(); c++)
+		for (const auto& seg : chunks[c].segments)
+		{
+			offsets[nodeIds[c][seg.start] + 1]++;
+			offsets[nodeIds[c][seg.end] + 1]++;
+		}
+	for (size_t i = 0; i < nodes.size(); i++)
+		offsets[i + 1] += offsets[i];
+
+	vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+	vector<StreetEdge> edges(offsets.back());
+	for (size_t c = 0; c < chunks.size(); c++)
+		for (const auto& seg : chunks[c].segments)
+		{
+			uint32_t startId = nodeIds[c][seg.start];
+			uint32_t endId = nodeIds[c][seg.end];
+			StreetEdge e;
+			e.nameId = nameIds[c][seg.nameId];
+			e.length = seg.length;
+			e.to = endId;
+			edges[next[startId]++] = e;
+			e.to = startId;
+			edges[next[endId]++] = e;
+		}
+
+	//the graph keeps its own copy of the coordinate text
+	vector<GeoCoord> coords(nodes.size());
+	for (size_t i = 0; i < nodes.size(); i++)
+	{
+		coords[i].latitudeText.assign(nodes[i].text.lat, nodes[i].text.latLength);
+		coords[i].longitudeText.assign(nodes[i].text.lon, nodes[i].text.lonLength);
+		coords[i].latitude = nodes[i].latitude;
+		coords[i].longitude = nodes[i].longitude;
+	}
+
+	//a hierarchy or landmarks built for the old graph mean nothing for the new one
+	m_hierarchy.clear();
+	m_landmarks.clear();
+	m_graph.build(coords, offsets, edges, names);
+
+	if (stats != nullptr)
+	{
+		stats->loadSeconds += chrono::duration<double>(chrono::steady_clock::now() - started).count();
+		stats->nodesLoaded += m_graph.nodeCount();
+		stats->edgesLoaded += m_graph.edgeCount();
+		stats->bytesAllocated += m_graph.imageSize();
+	}
 	return true;
 }
 
 bool StreetMapImpl::getSegmentsThatStartWith(const GeoCoord& gc, vector<StreetSegment>& segs) const
 {
-	auto segResults = m_map.find(gc);
+	uint32_t node = m_graph.findNode(gc);
 	//if no segments found, return false leave segs unchanged
-	if (segResults == nullptr)
+	if (node == StreetGraph::NO_NODE)
 		return false;
 
 	//if segments found, discard any values in segs and replace with results
 	segs.clear();
-	segs = *segResults;
+	for (const StreetEdge* e = m_graph.edgesBegin(node); e != m_graph.edgesEnd(node); e++)
+		segs.push_back(m_graph.segment(node, *e));
 
     return true;
 }
 
+bool StreetMapImpl::contains(const GeoCoord& gc) const
+{
+	return m_graph.findNode(gc) != StreetGraph::NO_NODE;
+}
+
+StreetEdgeRange StreetMapImpl::edgesFrom(const GeoCoord& gc) const
+{
+	uint32_t node = m_graph.findNode(gc);
+	//no segments start here
+	if (node == StreetGraph::NO_NODE)
+		return StreetEdgeRange();
+	return m_graph.edges(node);
+}
+
+bool StreetMapImpl::snapToNetwork(const GeoCoord& gc, GeoCoord& node) const
+{
+	//a coordinate that is already a node snaps to itself
+	uint32_t nearest = m_graph.findNode(gc);
+	if (nearest == StreetGraph::NO_NODE)
+		nearest = m_graph.nearestNode(gc.latitude, gc.longitude);
+	if (nearest == StreetGraph::NO_NODE)
+		return false;
+	node = m_graph.coord(nearest);
+	return true;
+}
+
+bool StreetMapImpl::snapToSegment(const GeoCoord& gc, StreetSegment& segment, GeoCoord& point) const
+{
+	uint32_t from;
+	uint32_t edge;
+	double t;
+	if (!m_graph.nearestSegment(gc.latitude, gc.longitude, from, edge, t))
+		return false;
+	segment = m_graph.segment(from, m_graph.edge(edge));
+
+	//the ends keep their exact text, so they can be routed from
+	if (t <= 0)
+		point = segment.start;
+	else if (t >= 1)
+		point = segment.end;
+	else
+	{
+		char lat[32];
+		char lon[32];
+		snprintf(lat, sizeof(lat), "%.7f", segment.start.latitude + t * (segment.end.latitude - segment.start.latitude));
+		snprintf(lon, sizeof(lon), "%.7f", segment.start.longitude + t * (segment.end.longitude - segment.start.longitude));
+		point = GeoCoord(lat, lon);
+	}
+	return true;
+}
+
+bool StreetMapImpl::saveSnapshot(string snapshotFile) const
+{
+	return m_graph.save(snapshotFile);
+}
+
+bool StreetMapImpl::loadSnapshot(string snapshotFile)
+{
+	//the snapshot holds the whole built graph, so there is nothing to parse
+	if (!m_graph.load(snapshotFile))
+		return false;
+	m_hierarchy.clear();
+	m_landmarks.clear();
+	return true;
+}
+
+void StreetMapImpl::buildHierarchy()
+{
+	m_hierarchy.build(m_graph);
+}
+
+bool StreetMapImpl::saveHierarchy(string hierarchyFile) const
+{
+	return m_hierarchy.save(hierarchyFile);
+}
+
+bool StreetMapImpl::loadHierarchy(string hierarchyFile)
+{
+	//only accepted if it was built for the graph loaded now
+	return m_hierarchy.load(hierarchyFile, m_graph);
+}
+
+void StreetMapImpl::buildLandmarks(int count)
+{
+	m_landmarks.build(m_graph, count);
+}
+
 //******************** StreetMap functions ************************************
 
 // These functions simply delegate to StreetMapImpl's functions.
@@ -157,12 +545,78 @@ StreetMap::~StreetMap()
     delete m_impl;
 }
 
-bool StreetMap::load(string mapFile)
+bool StreetMap::load(string mapFile, PlannerStats* stats)
 {
-    return m_impl->load(mapFile);
+    return m_impl->load(mapFile, stats);
 }
 
 bool StreetMap::getSegmentsThatStartWith(const GeoCoord& gc, vector<StreetSegment>& segs) const
 {
    return m_impl->getSegmentsThatStartWith(gc, segs);
 }
+
+bool StreetMap::contains(const GeoCoord& gc) const
+{
+    return m_impl->contains(gc);
+}
+
+StreetEdgeRange StreetMap::edgesFrom(const GeoCoord& gc) const
+{
+    return m_impl->edgesFrom(gc);
+}
+
+bool StreetMap::snapToNetwork(const GeoCoord& gc, GeoCoord& node) const
+{
+    return m_impl->snapToNetwork(gc, node);
+}
+
+bool StreetMap::snapToSegment(const GeoCoord& gc, StreetSegment& segment, GeoCoord& point) const
+{
+    return m_impl->snapToSegment(gc, segment, point);
+}
+
+bool StreetMap::saveSnapshot(string snapshotFile) const
+{
+    return m_impl->saveSnapshot(snapshotFile);
+}
+
+bool StreetMap::loadSnapshot(string snapshotFile)
+{
+    return m_impl->loadSnapshot(snapshotFile);
+}
+
+const StreetGraph& StreetMap::graph() const
+{
+    return m_impl->graph();
+}
+
+void StreetMap::buildHierarchy()
+{
+    m_impl->buildHierarchy();
+}
+
+bool StreetMap::saveHierarchy(string hierarchyFile) const
+{
+    return m_impl->saveHierarchy(hierarchyFile);
+}
+
+bool StreetMap::loadHierarchy(string hierarchyFile)
+{
+    return m_impl->loadHierarchy(hierarchyFile);
+}
+
+const ContractionHierarchy& StreetMap::hierarchy() const
+{
+    return m_impl->hierarchy();
+}
+
+void StreetMap::buildLandmarks(int count)
+{
+    m_impl->buildLandmarks(count);
+}
+
+const LandmarkIndex& StreetMap::landmarks() const
+{
+    return m_impl->landmarks();
+}
+
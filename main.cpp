@@ -1,15 +1,26 @@
 #include "provided.h"
+#include "PlanningServer.h"
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <string>
 #include <vector>
+#include <csignal>
 using namespace std;
 
 bool loadDeliveryRequests(string deliveriesFile, GeoCoord& depot, vector<DeliveryRequest>& v);
 bool parseDelivery(string line, string& lat, string& lon, string& item);
+void printStats(ostream& out, const PlannerStats& stats);
 
-int main(/*int argc, char *argv[]*/)
+//the server serving a socket, for SIGINT and SIGTERM to stop cleanly
+PlanningServer* socketServer = nullptr;
+void stopServing(int)
+{
+    if (socketServer != nullptr)
+        socketServer->stop();
+}
+
+int main(int argc, char *argv[])
 {
   /*  if (argc != 3)
     {
@@ -17,14 +28,70 @@ int main(/*int argc, char *argv[]*/)
         return 1;
     }*/
 
+    //flags, in any order:
+    //  --stats          print where the time went, after the plan (to cerr when serving)
+    //  --serve          keep the map loaded and plan requests from stdin (see PlanningServer.h)
+    //  --socket PATH    the same, but from connections to the Unix socket at PATH, until SIGINT or SIGTERM
+    bool wantStats = false;
+    bool serving = false;
+    string socketPath;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--stats")
+            wantStats = true;
+        else if (arg == "--serve")
+            serving = true;
+        else if (arg == "--socket" && i + 1 < argc)
+        {
+            serving = true;
+            socketPath = argv[++i];
+        }
+        else
+        {
+            cerr << "Usage: " << argv[0] << " [--stats] [--serve] [--socket PATH]" << endl;
+            return 1;
+        }
+    }
+    PlannerStats stats;
+
     StreetMap sm;
         
-    if (!sm.load("mapdata.txt"))
+    if (!sm.load("mapdata.txt", wantStats ? &stats : nullptr))
     {
         //cout << "Unable to load map data file " << argv[1] << endl;
         return 1;
     }
 
+    if (serving)
+    {
+        bool served = true;
+        {
+            //the server answers every request it has read before it is destroyed,
+            //so the stats are complete only after that
+            PlanningServer server(&sm);
+            if (wantStats)
+                server.setStats(&stats);
+            if (socketPath.empty())
+                server.serve(cin, cout);
+            else
+            {
+                socketServer = &server;
+                signal(SIGINT, stopServing);
+                signal(SIGTERM, stopServing);
+                served = server.serveSocket(socketPath);
+                signal(SIGINT, SIG_DFL);
+                signal(SIGTERM, SIG_DFL);
+                socketServer = nullptr;
+                if (!served)
+                    cerr << "Unable to serve on socket " << socketPath << endl;
+            }
+        }
+        if (wantStats)
+            printStats(cerr, stats);
+        return served ? 0 : 1;
+    }
+
     GeoCoord depot;
     vector<DeliveryRequest> deliveries;
     if (!loadDeliveryRequests("deliveries.txt", depot, deliveries))
@@ -36,6 +103,8 @@ int main(/*int argc, char *argv[]*/)
     cout << "Generating route...\n\n";
 
     DeliveryPlanner dp(&sm);
+    if (wantStats)
+        dp.setStats(&stats);
     vector<DeliveryCommand> dcs;
     double totalMiles;
     DeliveryResult result = dp.generateDeliveryPlan(depot, deliveries, dcs, totalMiles);
@@ -56,6 +125,8 @@ int main(/*int argc, char *argv[]*/)
     cout.setf(ios::fixed);
     cout.precision(2);
     cout << totalMiles << " miles travelled for all deliveries." << endl;
+    if (wantStats)
+        printStats(cout, stats);
 }
 
 bool loadDeliveryRequests(string deliveriesFile, GeoCoord& depot, vector<DeliveryRequest>& v)
@@ -100,3 +171,19 @@ bool parseDelivery(string line, string& lat, string& lon, string& item)
     }
     return true;
 }
+
+void printStats(ostream& out, const PlannerStats& stats)
+{
+    out.setf(ios::fixed);
+    out.precision(2);
+    out << "\nload:     " << stats.loadSeconds * 1000 << " ms, " << stats.nodesLoaded << " nodes, "
+        << stats.edgesLoaded << " edges" << endl;
+    out << "optimize: " << stats.optimizeSeconds * 1000 << " ms, " << stats.distanceSearches << " distance searches, "
+        << stats.annealingMoves << " annealing moves, " << stats.localSearchMoves << " local search moves" << endl;
+    out << "route:    " << stats.routeSeconds * 1000 << " ms, " << stats.routes << " routes (" << stats.cacheHits
+        << " cached), " << stats.nodesExpanded << " nodes expanded" << endl;
+    out << "          " << stats.openPushes << " open list pushes, " << stats.openPops << " pops, "
+        << stats.hashProbes << " hash probes" << endl;
+    out << "commands: " << stats.commandSeconds * 1000 << " ms, " << stats.commands << " commands" << endl;
+    out << "memory:   " << stats.bytesAllocated / 1024 << " KB in graph, matrices and search state" << endl;
+}
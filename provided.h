@@ -8,6 +8,8 @@
 #include <string>
 #include <vector>
 #include <list>
+#include <cstdint>
+#include <functional>
 
 enum DeliveryResult
 {
@@ -71,6 +73,88 @@ bool operator==(const StreetSegment& lhs, const StreetSegment& rhs)
     return lhs.start == rhs.start  &&  lhs.end == rhs.end;
 }
 
+  // An outgoing edge of a node in the StreetMap's compact graph
+struct StreetEdge
+{
+    uint32_t to;      // id of the node the edge leads to
+    uint32_t nameId;  // index of the edge's street name
+    double   length;  // in miles
+};
+
+  // A non-owning view of the edges leaving one node, valid until the StreetMap
+  // that produced it is reloaded or destroyed
+struct StreetEdgeRange
+{
+    StreetEdgeRange(const StreetEdge* b = nullptr, const StreetEdge* e = nullptr)
+     : first(b), last(e)
+    {}
+
+    const StreetEdge* begin() const { return first; }
+    const StreetEdge* end() const { return last; }
+    size_t size() const { return last - first; }
+    bool empty() const { return first == last; }
+
+    const StreetEdge* first;
+    const StreetEdge* last;
+};
+
+class StreetGraph;
+struct RouteStep;
+class ContractionHierarchy;
+class LandmarkIndex;
+  // Counters and wall times, for finding where a slow plan spent its time.
+  // Collecting is opt-in: pass one to StreetMap::load, or to setStats on a
+  // router, optimizer or planner, and it is added to from then on; with none
+  // given nothing is recorded.  It isn't locked, so each thread needs its own.
+struct PlannerStats
+{
+      // wall time in seconds, by phase
+    double loadSeconds = 0;
+    double optimizeSeconds = 0;   // ordering deliveries, road distance matrices included
+    double routeSeconds = 0;      // point to point routes
+    double commandSeconds = 0;    // turning routes into commands
+      // loading
+    uint64_t nodesLoaded = 0;
+    uint64_t edgesLoaded = 0;
+      // routing
+    uint64_t routes = 0;
+    uint64_t cacheHits = 0;       // routes answered from the route cache
+    uint64_t nodesExpanded = 0;   // nodes settled by the searches
+    uint64_t openPushes = 0;
+    uint64_t openPops = 0;        // out of date entries skipped included
+    uint64_t hashProbes = 0;      // node to search state lookups
+      // ordering
+    uint64_t distanceSearches = 0;  // one to many searches for road distance matrices
+    uint64_t annealingMoves = 0;    // moves tried
+    uint64_t localSearchMoves = 0;  // improving moves taken
+      // planning
+    uint64_t commands = 0;
+      // bytes of the big buffers: graph images, distance matrices and search state
+    uint64_t bytesAllocated = 0;
+
+    PlannerStats& operator+=(const PlannerStats& other)
+    {
+        loadSeconds += other.loadSeconds;
+        optimizeSeconds += other.optimizeSeconds;
+        routeSeconds += other.routeSeconds;
+        commandSeconds += other.commandSeconds;
+        nodesLoaded += other.nodesLoaded;
+        edgesLoaded += other.edgesLoaded;
+        routes += other.routes;
+        cacheHits += other.cacheHits;
+        nodesExpanded += other.nodesExpanded;
+        openPushes += other.openPushes;
+        openPops += other.openPops;
+        hashProbes += other.hashProbes;
+        distanceSearches += other.distanceSearches;
+        annealingMoves += other.annealingMoves;
+        localSearchMoves += other.localSearchMoves;
+        commands += other.commands;
+        bytesAllocated += other.bytesAllocated;
+        return *this;
+    }
+};
+
 class StreetMapImpl;
 
 class StreetMap
@@ -78,8 +162,34 @@ class StreetMap
 public:
     StreetMap();
     ~StreetMap();
-    bool load(std::string mapFile);
+    bool load(std::string mapFile, PlannerStats* stats = nullptr);
     bool getSegmentsThatStartWith(const GeoCoord& gc, std::vector<StreetSegment>& segs) const;
+      // Whether any segment starts at gc, and the edges that do (an empty range if
+      // none), without copying any StreetSegments; see StreetGraph for edge targets
+    bool contains(const GeoCoord& gc) const;
+    StreetEdgeRange edgesFrom(const GeoCoord& gc) const;
+      // Snap any coordinate onto the map: the nearest segment endpoint (which
+      // the router accepts), or the nearest segment and the closest point on it.
+      // Both use a grid built by load; they return false only for an empty map.
+    bool snapToNetwork(const GeoCoord& gc, GeoCoord& node) const;
+    bool snapToSegment(const GeoCoord& gc, StreetSegment& segment, GeoCoord& point) const;
+      // Write the loaded map to a binary snapshot, or replace the map with one
+      // read back from a snapshot (memory mapped, no parsing)
+    bool saveSnapshot(std::string snapshotFile) const;
+    bool loadSnapshot(std::string snapshotFile);
+      // The compact graph built by load; see StreetGraph.h
+    const StreetGraph& graph() const;
+      // Optional preprocessing for fast routing: contract the loaded map into a
+      // hierarchy (see ContractionHierarchy.h), or save it / load one saved for
+      // this same map.  Loading another map drops the hierarchy.
+    void buildHierarchy();
+    bool saveHierarchy(std::string hierarchyFile) const;
+    bool loadHierarchy(std::string hierarchyFile);
+    const ContractionHierarchy& hierarchy() const;
+      // Optional preprocessing for tighter A* bounds: road distances from count
+      // landmarks to every node (see LandmarkIndex.h).  Loading a map drops them.
+    void buildLandmarks(int count = 16);
+    const LandmarkIndex& landmarks() const;
       // We prevent a StreetMap object from being copied or assigned.
     StreetMap(const StreetMap&) = delete;
     StreetMap& operator=(const StreetMap&) = delete;
@@ -87,6 +197,24 @@ private:
     StreetMapImpl* m_impl;
 };
 
+  // How a PointToPointRouter searches the street graph
+enum RouteSearchMode
+{
+    SEARCH_ASTAR,                // forward A* from the start (the default)
+    SEARCH_BIDIRECTIONAL_ASTAR,  // A* from both ends at once, meeting in the middle
+    SEARCH_CONTRACTION_HIERARCHY // upward search of the map's hierarchy; bidirectional
+                                 // A* if the map has none
+};
+
+  // Counters of a PointToPointRouter's route cache
+struct RouteCacheStats
+{
+    uint64_t hits;
+    uint64_t misses;
+    int      size;       // routes held now
+    int      capacity;
+};
+
 class PointToPointRouterImpl;
 
 class PointToPointRouter
@@ -99,6 +227,21 @@ public:
         const GeoCoord& end,
         std::list<StreetSegment>& route,
         double& totalDistanceTravelled) const;
+      // The same route as the graph's edges (see StreetGraph.h), without building
+      // any StreetSegments; path is cleared first, so one vector can serve many calls
+    DeliveryResult generatePointToPointPath(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        std::vector<RouteStep>& path,
+        double& totalDistanceTravelled) const;
+    void setSearchMode(RouteSearchMode mode);
+      // Keep up to capacity recently found routes, and answer repeated (or
+      // reversed) queries from them; 0, the default, turns the cache off.  The
+      // cache is safe to share between threads using the same router.
+    void setRouteCacheCapacity(int capacity);
+    RouteCacheStats routeCacheStats() const;
+      // Add this router's counters and times to stats (nullptr, the default, to stop)
+    void setStats(PlannerStats* stats);
       // We prevent a PointToPointRouter object from being copied or assigned.
     PointToPointRouter(const PointToPointRouter&) = delete;
     PointToPointRouter& operator=(const PointToPointRouter&) = delete;
@@ -115,6 +258,14 @@ struct DeliveryRequest
     GeoCoord location;
 };
 
+  // What a DeliveryOptimizer minimizes
+enum DistanceMetric
+{
+    ROAD_DISTANCE,   // shortest routes along the map (the default); falls back to
+                     // crow distance if some stop is off the map or unreachable
+    CROW_DISTANCE    // straight line distances
+};
+
 class DeliveryOptimizerImpl;
 
 class DeliveryOptimizer
@@ -127,6 +278,29 @@ public:
         std::vector<DeliveryRequest>& deliveries,
         double& oldCrowDistance,
         double& newCrowDistance) const;
+    void setDistanceMetric(DistanceMetric metric);
+      // Anneal over random 2-opt, Or-opt and swap moves before the final local
+      // search (the default), or only run the local search from the given order
+    void setAnnealing(bool anneal);
+      // Run this many independent annealing chains, one per thread, and keep the
+      // best tour (1 by default; 0 means one per hardware thread).  Each chain's
+      // random numbers come from the seed, so a given seed and chain count always
+      // give the same order.
+    void setAnnealingChains(int chains);
+    void setSeed(uint64_t seed);
+      // Find the provably shortest order (Held-Karp) for batches of at most this
+      // many deliveries: 12 by default, at most 16, 0 to always use the heuristic
+    void setExactThreshold(int stops);
+      // Split more than this many deliveries into clusters of about this many nearby
+      // ones, order the clusters separately and in parallel, and join them up
+      // (200 by default, at least 8, 0 to always order them as one tour)
+    void setClusterSize(int stops);
+      // Most threads one call may use for annealing chains and clusters (0, the
+      // default, for one per hardware thread); 1 when the caller already runs
+      // orderings in parallel.  The chains run in turn, so the order is the same.
+    void setThreadLimit(int threads);
+      // Add this optimizer's counters and times to stats (nullptr, the default, to stop)
+    void setStats(PlannerStats* stats);
       // We prevent a DeliveryOptimizer object from being copied or assigned.
     DeliveryOptimizer(const DeliveryOptimizer&) = delete;
     DeliveryOptimizer& operator=(const DeliveryOptimizer&) = delete;
@@ -142,7 +316,7 @@ public:
     {}
 
       // make this DeliveryCommand a Proceed command
-    void initAsProceedCommand(std::string dir, std::string streetName, double dist)
+    void initAsProceedCommand(const std::string& dir, const std::string& streetName, double dist)
     {
         m_type = PROCEED;
         m_streetName = streetName;
@@ -151,7 +325,7 @@ public:
     }
 
       // make this DeliveryCommand a Turn command
-    void initAsTurnCommand(std::string dir, std::string streetName)
+    void initAsTurnCommand(const std::string& dir, const std::string& streetName)
     {
         m_type = TURN;
         m_streetName = streetName;
@@ -160,7 +334,7 @@ public:
     }
 
       // make this DeliveryCommand a Deliver command
-    void initAsDeliverCommand(std::string item)
+    void initAsDeliverCommand(const std::string& item)
     {
         m_type = DELIVER;
         m_item = item;
@@ -208,6 +382,36 @@ private:
     double       m_distance;    // 1.92 (in miles)
 };
 
+  // One instruction of a plan from DeliveryPlanner::streamDeliveryPlan.  Nothing
+  // is copied: streetName points into the StreetMap's table of names, direction
+  // to a string literal and item into the planner's copy of the deliveries, so a
+  // step is only good for the duration of the call that passes it on.
+struct DeliveryStep
+{
+    enum Kind { PROCEED, TURN, DELIVER };
+    Kind        kind;
+    const char* direction;   // "northeast" etc. to proceed, "left" or "right" to turn
+    const char* streetName;  // PROCEED and TURN
+    const char* item;        // DELIVER
+    double      distance;    // PROCEED, in miles
+};
+
+typedef std::function<void(const DeliveryStep&)> DeliverySink;
+
+  // One plan for DeliveryPlanner::planBatch to work out, and what came of it
+struct DeliveryJob
+{
+    GeoCoord depot;
+    std::vector<DeliveryRequest> deliveries;
+};
+
+struct DeliveryPlan
+{
+    DeliveryResult result = DELIVERY_SUCCESS;
+    std::vector<DeliveryCommand> commands;
+    double totalDistanceTravelled = 0;
+};
+
 class DeliveryPlannerImpl;
 
 class DeliveryPlanner
@@ -220,6 +424,25 @@ public:
         const std::vector<DeliveryRequest>& deliveries,
         std::vector<DeliveryCommand>& commands,
         double& totalDistanceTravelled) const;
+      // The same plan, passed to sink a step at a time as each leg is routed,
+      // so the first steps arrive before the rest of the plan is worked out.
+      // If some leg can't be routed, the steps before it have already been sent.
+    DeliveryResult streamDeliveryPlan(
+        const GeoCoord& depot,
+        const std::vector<DeliveryRequest>& deliveries,
+        const DeliverySink& sink,
+        double& totalDistanceTravelled) const;
+      // Add the counters and times of this planner, its router and its optimizer
+      // to stats (nullptr, the default, to stop); planBatch's workers count too
+    void setStats(PlannerStats* stats);
+      // Most threads one plan may use to order its deliveries (see
+      // DeliveryOptimizer::setThreadLimit)
+    void setThreadLimit(int threads);
+      // Plan every job, on threads workers (0 means one per hardware thread)
+      // sharing this planner's StreetMap; each worker has its own router and
+      // optimizer, set up as this planner's, and an equal share (at least one)
+      // of its thread limit.  plans[i] is the plan for jobs[i].
+    void planBatch(const std::vector<DeliveryJob>& jobs, std::vector<DeliveryPlan>& plans, int threads = 0) const;
       // We prevent a DeliveryPlanner object from being copied or assigned.
     DeliveryPlanner(const DeliveryPlanner&) = delete;
     DeliveryPlanner& operator=(const DeliveryPlanner&) = delete;
@@ -253,20 +476,28 @@ inline double rad2deg(double rad) {
 * @param lon2d Longitude of the second point in degrees
 * @return The distance between the two points in kilometers
 */
-inline double distanceEarthKM(const GeoCoord& g1, const GeoCoord& g2) {
+inline double distanceEarthKM(double lat1d, double lon1d, double lat2d, double lon2d) {
     static const double earthRadiusKm = 6371.0;
-    double lat1r = deg2rad(g1.latitude);
-    double lon1r = deg2rad(g1.longitude);
-    double lat2r = deg2rad(g2.latitude);
-    double lon2r = deg2rad(g2.longitude);
+    double lat1r = deg2rad(lat1d);
+    double lon1r = deg2rad(lon1d);
+    double lat2r = deg2rad(lat2d);
+    double lon2r = deg2rad(lon2d);
     double u = std::sin((lat2r - lat1r) / 2);
     double v = std::sin((lon2r - lon1r) / 2);
     return 2.0 * earthRadiusKm * std::asin(std::sqrt(u * u + std::cos(lat1r) * std::cos(lat2r) * v * v));
 }
 
-inline double distanceEarthMiles(const GeoCoord& g1, const GeoCoord& g2) {
+inline double distanceEarthKM(const GeoCoord& g1, const GeoCoord& g2) {
+    return distanceEarthKM(g1.latitude, g1.longitude, g2.latitude, g2.longitude);
+}
+
+inline double distanceEarthMiles(double lat1d, double lon1d, double lat2d, double lon2d) {
     const double milesPerKm = 1 / 1.609344;
-    return distanceEarthKM(g1, g2) * milesPerKm;
+    return distanceEarthKM(lat1d, lon1d, lat2d, lon2d) * milesPerKm;
+}
+
+inline double distanceEarthMiles(const GeoCoord& g1, const GeoCoord& g2) {
+    return distanceEarthMiles(g1.latitude, g1.longitude, g2.latitude, g2.longitude);
 }
 
 inline double angleBetween2Lines(const StreetSegment& line1, const StreetSegment& line2)